@@ -0,0 +1,93 @@
+#pragma once
+
+#include "bitstream.hpp"
+
+#include "cstdint"
+#include "stdexcept"
+#include "string"
+#include "vector"
+
+
+// Raised when an archive can't be decoded or doesn't match its checksum.
+struct IntegrityError {
+    std::string reason;
+};
+
+// Every archive starts with
+//
+//   magic "ARCH"(32) | version(8) | algorithm(8) | flags(8) | order(8) | lzw bits(8)
+//
+// so -d and -t can decode it without being told how it was made.
+struct ArchiveHeader {
+    static constexpr uint32_t MAGIC = 0x41524348; // "ARCH"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t BLOCKS_FLAG = 1 << 0;
+    static constexpr uint32_t SOLID_FLAG = 1 << 1; // a SolidArchive follows
+    static constexpr uint32_t BAC32_FLAG = 1 << 2; // BAC stages are BAC32
+    static constexpr uint32_t DEDUP_FLAG = 1 << 3; // solid members are chunk lists
+    static constexpr size_t SIZE = 9;
+
+    uint32_t algorithm = 0;
+    uint32_t flags = 0;
+    int order = 0; // model order of BAC and the range coder, may be negative
+    int lzw_bits = 0;
+
+    void write(BitStream& fo) const {
+        fo.writeBits(MAGIC, 32);
+        fo.writeBits(VERSION, 8);
+        fo.writeBits(algorithm, 8);
+        fo.writeBits(flags, 8);
+        fo.writeBits(static_cast<uint8_t>(order), 8);
+        fo.writeBits(lzw_bits, 8);
+    }
+
+    static ArchiveHeader read(BitStream& fi) {
+        ArchiveHeader header;
+        try {
+            if (fi.readBits(32) != MAGIC) {
+                throw IntegrityError{"not an archive"};
+            }
+            if (fi.readBits(8) != VERSION) {
+                throw IntegrityError{"unsupported archive version"};
+            }
+            header.algorithm = fi.readBits(8);
+            header.flags = fi.readBits(8);
+            header.order = static_cast<int8_t>(fi.readBits(8));
+            header.lzw_bits = fi.readBits(8);
+        } catch (EOFReachedException& ex) {
+            throw IntegrityError{"not an archive"};
+        }
+        return header;
+    }
+};
+
+// ...and ends, after the byte-aligned payload, with
+//
+//   original size(64) | CRC32C of the original(32)
+struct ArchiveTrailer {
+    static constexpr size_t SIZE = 12;
+
+    uint64_t size = 0;
+    uint32_t crc = 0;
+
+    void write(BitStream& fo) const {
+        fo.alignToByte();
+        fo.writeBits(static_cast<uint32_t>(size >> 32), 32);
+        fo.writeBits(static_cast<uint32_t>(size), 32);
+        fo.writeBits(crc, 32);
+    }
+
+    static ArchiveTrailer read(const std::vector<unsigned char>& bytes) {
+        if (bytes.size() != SIZE) {
+            throw IntegrityError{"truncated archive"};
+        }
+        auto word = [&bytes](size_t i) {
+            return uint32_t(bytes[i]) << 24 | uint32_t(bytes[i + 1]) << 16
+                 | uint32_t(bytes[i + 2]) << 8 | uint32_t(bytes[i + 3]);
+        };
+        ArchiveTrailer trailer;
+        trailer.size = uint64_t(word(0)) << 32 | word(4);
+        trailer.crc = word(8);
+        return trailer;
+    }
+};
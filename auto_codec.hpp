@@ -0,0 +1,213 @@
+#pragma once
+
+#include "bitstream.hpp"
+#include "lzw.hpp"
+#include "bac.hpp"
+#include "pipeline.hpp"
+
+#include "cmath"
+#include "cstdint"
+#include "algorithm"
+#include "functional"
+#include "memory"
+#include "string"
+#include "vector"
+#include "stdexcept"
+
+
+// Picks the coder for a piece of data by looking at it first, and stores
+// data that no coder would shrink as is:
+//
+//   method(8) | output of that method
+//
+// Meant to code one block of a BlockCodec stream or solid archive at a
+// time, as the whole input is held in memory.
+//
+// The choice is made from an order-0 entropy estimate over a sample spread
+// across the input and, unless the entropy alone says the data is noise, a
+// trial of LZW and LZW+BAC over a prefix. A method must save at least
+// 1/MIN_GAIN of the size to be used over storing, so near-random data
+// costs a histogram and a copy.
+class AutoCodec {
+public:
+    using Codec = std::function<void(BitStream&, BitStream&)>;
+
+    enum Method : uint8_t {
+        STORED = 0,
+        LZW_ONLY = 1,
+        BAC_ONLY = 2,
+        LZW_BAC = 3
+    };
+
+private:
+    static constexpr int BYTE_SIZE = 8;
+    static constexpr size_t SAMPLE_SIZE = 64 << 10; // bytes histogrammed
+    static constexpr size_t SAMPLE_SLICES = 8;
+    static constexpr size_t TRIAL_SIZE = 32 << 10;  // prefix trial-coded
+    static constexpr size_t MIN_GAIN = 32;
+    static constexpr size_t COPY_CHUNK = 1 << 16;
+
+    int order;
+    int lzw_bits;
+    int bac_bits;
+
+    using Bytes = std::vector<unsigned char>;
+
+    // Shannon entropy of the byte histogram, in bits per byte.
+    static double entropy(const unsigned char* data, size_t size) {
+        uint64_t counts[256] = {};
+        uint64_t total = 0;
+        auto count = [&](const unsigned char* p, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                ++counts[p[i]];
+            }
+            total += n;
+        };
+        if (size <= SAMPLE_SIZE) {
+            count(data, size);
+        } else {
+            size_t slice = SAMPLE_SIZE / SAMPLE_SLICES;
+            size_t stride = (size - slice) / (SAMPLE_SLICES - 1);
+            for (size_t i = 0; i < SAMPLE_SLICES; ++i) {
+                count(data + i * stride, slice);
+            }
+        }
+        double bits = 0;
+        for (uint64_t c : counts) {
+            if (c != 0) {
+                double p = double(c) / total;
+                bits -= p * std::log2(p);
+            }
+        }
+        return bits;
+    }
+
+    static Bytes code(const Codec& codec, const unsigned char* data, size_t size) {
+        Bytes out;
+        BitStream fi(std::make_unique<MemorySource>(data, size));
+        BitStream fo(std::make_unique<VectorSink>(out));
+        codec(fi, fo);
+        fo.finish();
+        return out;
+    }
+
+    Codec compressor(Method method) const {
+        int order = this->order;
+        int bits = lzw_bits;
+        int bac_bits = this->bac_bits;
+        Codec bac = [order, bac_bits](BitStream& fi, BitStream& fo) {
+            WithBAC(bac_bits, order, [&](auto& coder) { coder.Compress(fi, fo); });
+        };
+        if (method == LZW_ONLY) {
+            return [bits](BitStream& fi, BitStream& fo) { LZW(bits).Compress(fi, fo); };
+        }
+        else if (method == BAC_ONLY) {
+            return bac;
+        }
+        return [bac, bits](BitStream& fi, BitStream& fo) {
+            Pipeline(
+                [bits](BitStream& in, BitStream& out) { LZW(bits).Compress(in, out); },
+                bac
+            ).Run(fi, fo);
+        };
+    }
+
+public:
+    // order, lzw_bits and bac_bits configure BAC and LZW when they are
+    // chosen; the decoder needs the same order and bac_bits.
+    AutoCodec(int order = BAC::LEGACY_ORDER, int lzw_bits = LZW::DEFAULT_MAX_BITS,
+              int bac_bits = BAC::CODE_BITS)
+    : order(order), lzw_bits(lzw_bits), bac_bits(bac_bits) {}
+
+    // The method Compress would use for these bytes.
+    Method Analyze(const unsigned char* data, size_t size) const {
+        if (size == 0) {
+            return STORED;
+        }
+        double limit = double(size) * (MIN_GAIN - 1) / MIN_GAIN;
+        double bac_size = entropy(data, size) / BYTE_SIZE * size;
+        if (bac_size >= limit) {
+            // an order-0 histogram this flat is noise or already packed
+            return STORED;
+        }
+        Method best = BAC_ONLY;
+        double best_size = bac_size;
+
+        size_t trial = std::min(size, TRIAL_SIZE);
+        double scale = double(size) / trial;
+        Bytes lzw = code(compressor(LZW_ONLY), data, trial);
+        if (lzw.size() * scale < best_size) {
+            best = LZW_ONLY;
+            best_size = lzw.size() * scale;
+        }
+        Bytes lzw_bac = code(compressor(BAC_ONLY), lzw.data(), lzw.size());
+        if (lzw_bac.size() * scale < best_size) {
+            best = LZW_BAC;
+        }
+        return best;
+    }
+
+    void Compress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Compress(fi, fo);
+    }
+
+    void Compress(BitStream& fi, BitStream& fo) {
+        Bytes data;
+        size_t n;
+        do {
+            size_t at = data.size();
+            data.resize(at + COPY_CHUNK);
+            n = fi.readBytes(data.data() + at, COPY_CHUNK);
+            data.resize(at + n);
+        } while (n == COPY_CHUNK);
+
+        Method method = Analyze(data.data(), data.size());
+        fo.writeBits(method, BYTE_SIZE);
+        if (method == STORED) {
+            fo.writeBytes(data.data(), data.size());
+            return;
+        }
+        BitStream coded_in(std::make_unique<MemorySource>(data.data(), data.size()));
+        compressor(method)(coded_in, fo);
+    }
+
+    void Decompress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Decompress(fi, fo);
+    }
+
+    void Decompress(BitStream& fi, BitStream& fo) {
+        int method = fi.getByte();
+        if (method == std::istream::traits_type::eof()) {
+            throw std::runtime_error("AutoCodec: truncated input");
+        }
+        if (method == STORED) {
+            Bytes chunk(COPY_CHUNK);
+            while (size_t n = fi.readBytes(chunk.data(), chunk.size())) {
+                fo.writeBytes(chunk.data(), n);
+            }
+        }
+        else if (method == LZW_ONLY) {
+            LZW().Decompress(fi, fo);
+        }
+        else if (method == BAC_ONLY) {
+            WithBAC(bac_bits, order, [&](auto& bac) { bac.Decompress(fi, fo); });
+        }
+        else if (method == LZW_BAC) {
+            int order = this->order;
+            int bac_bits = this->bac_bits;
+            Pipeline(
+                [order, bac_bits](BitStream& in, BitStream& out) {
+                    WithBAC(bac_bits, order, [&](auto& bac) { bac.Decompress(in, out); });
+                },
+                [](BitStream& in, BitStream& out) { LZW().Decompress(in, out); }
+            ).Run(fi, fo);
+        }
+        else {
+            throw std::runtime_error("AutoCodec: corrupted input, unknown method");
+        }
+    }
+};
@@ -1,90 +1,57 @@
+#pragma once
+
 #include "bitstream.hpp"
+#include "frequency_model.hpp"
+#include "static_model.hpp"
 
 #include "cstdint"
+#include "stdexcept"
 #include "string"
+#include "type_traits"
 
 
-class BAC {
-private:
-    const int BYTE_SIZE = 8;
-    const int EOF_CODE = 256;
-
-    uint32_t CODE_VALUE_BITS = 17;
-    uint32_t MAX_CODE = (uint32_t(1) << CODE_VALUE_BITS) - 1;
-    uint32_t ONE_FOURTH = (uint32_t(1) << (CODE_VALUE_BITS - 2));
-    uint32_t ONE_HALF = ONE_FOURTH * 2;
-    
-    uint32_t THREE_FOURTHS = ONE_FOURTH * 3;
-
-    struct Probability {
-        uint32_t low;
-        uint32_t high;
-        uint32_t count;
-    };
-
-    class Model {
-    private:
-        uint32_t FREQUENCY_BITS = 15;
-        uint32_t MAX_FREQUENCY = (uint32_t(1) << FREQUENCY_BITS) - 1;
-        bool is_full;
-    public:
-        std::vector<uint32_t> cumulative_frequency;
-        void reset() {
-            cumulative_frequency.clear();
-            for (int i = 0; i <= 257; ++i) {
-                cumulative_frequency.push_back(i);
-            }
-            is_full = false;
-        }
+// Binary arithmetic coder with CodeBits of code value precision, whose
+// legacy model freezes at 2^FreqBits. Both are compile-time constants so
+// the coding loops work on immediates; CodeBits + FreqBits over 32 bits
+// switches the coder state to 64-bit arithmetic. Streams of different
+// configurations are not compatible.
+template <int CodeBits, int FreqBits>
+class BasicBAC {
+public:
+    static_assert(CodeBits <= 32, "BasicBAC: code values are read 32 bits at a time");
+    static_assert(FreqBits <= CodeBits - 2, "BasicBAC: counts must fit in a quarter of the code range");
+    static_assert(CodeBits >= 17, "BasicBAC: the context and static models count up to 2^15");
 
-        void update(int c) {
-            for (int i = c + 1; i <= 257; ++i) {
-                ++cumulative_frequency[i];
-            }
-            if (cumulative_frequency[257] >= MAX_FREQUENCY) {
-                is_full = true;
-            }   
-        }
+    using Model = BasicFrequencyModel<FreqBits>;
 
-        Probability getProbability(int c) {
-            Probability prob =  {
-                cumulative_frequency[c],
-                cumulative_frequency[c + 1],
-                cumulative_frequency[257]
-            };
-            if (!is_full) {
-                update(c);
-            }
-            return prob;
-        }
+    static constexpr int CODE_BITS = CodeBits;
 
-        Probability getChar(uint32_t scaled_value, int &c) {
-            for (int i = 0; i <= 256; ++i) {
-                if (scaled_value < cumulative_frequency[i + 1]) {
-                    c = i;
-                    Probability prob = {
-                        cumulative_frequency[i],
-                        cumulative_frequency[i+1],
-                        cumulative_frequency[257]
-                    };
-
-                    if (!is_full) {
-                        update(c);
-                    }
-                    return prob;
-                }
-            }
-            throw std::logic_error("Error in getChar");
-        }
+    // order of the default model: the original order-0 model, frozen when full
+    static constexpr int LEGACY_ORDER = -1;
+    // two-pass coding against a StaticModel stored ahead of the payload
+    static constexpr int STATIC_ORDER = -2;
 
-        uint32_t getCount() {
-            return cumulative_frequency[257];
-        }
-    };
+private:
+    // wide enough for a range times a model count
+    using Code = std::conditional_t<(CodeBits + FreqBits > 32), uint64_t, uint32_t>;
 
+    static constexpr int BYTE_SIZE = 8;
+    static constexpr int EOF_CODE = 256;
+
+    static constexpr uint32_t CODE_VALUE_BITS = CodeBits;
+    static constexpr Code MAX_CODE = (Code(1) << CODE_VALUE_BITS) - 1;
+    static constexpr Code ONE_FOURTH = (Code(1) << (CODE_VALUE_BITS - 2));
+    static constexpr Code ONE_HALF = ONE_FOURTH * 2;
+    static constexpr Code THREE_FOURTHS = ONE_FOURTH * 3;
+
+    int order;
     Model model;
 
     void flush_bits(uint8_t bit, uint32_t& pending_bits, BitStream& fo) {
+        if (pending_bits > 0) {
+            STATS_ADD(PENDING_BURSTS, 1);
+            STATS_MAX(PENDING_BITS_MAX, pending_bits);
+        }
         fo.writeBits(bit, 1);
         bit = !bit;
         for (int i = 0; i < pending_bits; ++i) {
@@ -93,16 +60,10 @@ private:
         pending_bits = 0;
     }
 
-public:
-    BAC() {}
-    void Compress(std::string in, std::string out) {
-        BitStream fi(in, "r");
-        BitStream fo(out,"w");
-
-        model.reset();
-
-        uint32_t low = 0;
-        uint32_t high = MAX_CODE;
+    template <class M>
+    void Encode(M& model, BitStream& fi, BitStream& fo) {
+        Code low = 0;
+        Code high = MAX_CODE;
 
         uint32_t pending_bits = 0;
         int c = 0;
@@ -113,7 +74,7 @@ public:
             }
 
             Probability prob = model.getProbability(c);
-            uint32_t range = high - low + 1;
+            Code range = high - low + 1;
             high = low + (range * prob.high / prob.count) - 1;
             low = low + (range * prob.low / prob.count);
 
@@ -152,21 +113,32 @@ public:
     }
 
 
-    void Decompress(std::string in, std::string out) {
-        BitStream fi(in, "r");
-        BitStream fo(out,"w");
-
-        model.reset();
+    template <class M>
+    void Decode(M& model, BitStream& fi, BitStream& fo) {
+        Code low = 0;
+        Code high = MAX_CODE;
+        Code val = 0;
 
-        uint32_t low = 0;
-        uint32_t high = MAX_CODE;
-        uint32_t val = 0;
+        try {
+            val += fi.readBits(CODE_VALUE_BITS);
+        } catch (EOFReachedException& ex) {
+            // a stream shorter than the code value: missing bits are zeros
+            for (uint32_t i = 0; i < CODE_VALUE_BITS; ++i) {
+                val <<= 1;
+                try {
+                    val += fi.readBits(1);
+                } catch (EOFReachedException& ex) {
+                }
+            }
+        }
 
-        val += fi.readBits(CODE_VALUE_BITS);
+        // a whole stream wants at most a bit or so past its end; garbage
+        // after a truncation would otherwise never reach EOF_CODE
+        uint32_t past_end = 0;
 
         while (true) {
-            uint32_t range = high - low + 1;
-            uint32_t scaled_val = ((val - low + 1) * model.getCount() - 1) / range;
+            Code range = high - low + 1;
+            uint32_t scaled_val = static_cast<uint32_t>(((val - low + 1) * model.getCount() - 1) / range);
             
             int c;
             Probability prob = model.getChar(scaled_val, c);
@@ -178,7 +150,6 @@ public:
             high = low + (range * prob.high) / prob.count - 1;
             low = low + (range * prob.low) / prob.count;
 
-            int t = 1;
             for (;;) {
                 if (high < ONE_HALF) {
 
@@ -205,9 +176,76 @@ public:
                 try {
                     val += fi.readBits(1);
                 } catch (EOFReachedException& ex) {
+                    if (++past_end > CODE_VALUE_BITS) {
+                        throw std::runtime_error("BAC: truncated input");
+                    }
                     break;
                 }
             }
         }
     }
+
+public:
+    // order 0..ContextModel::MAX_ORDER selects a context model that halves
+    // its counts instead of freezing; the decoder must use the same order.
+    // STATIC_ORDER reads the input twice.
+    BasicBAC(int order = LEGACY_ORDER) : order(order) {}
+
+    void Compress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Compress(fi, fo);
+    }
+
+    void Compress(BitStream& fi, BitStream& fo) {
+        if (order == LEGACY_ORDER) {
+            model.reset();
+            Encode(model, fi, fo);
+        } else if (order == STATIC_ORDER) {
+            StaticModel::TwoPass(fi, fo, [this, &fo](StaticModel& m, BitStream& in) { Encode(m, in, fo); });
+        } else {
+            ContextModel context_model(order);
+            Encode(context_model, fi, fo);
+        }
+    }
+
+    void Decompress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Decompress(fi, fo);
+    }
+
+    void Decompress(BitStream& fi, BitStream& fo) {
+        if (order == LEGACY_ORDER) {
+            model.reset();
+            Decode(model, fi, fo);
+        } else if (order == STATIC_ORDER) {
+            StaticModel static_model;
+            static_model.read(fi);
+            Decode(static_model, fi, fo);
+        } else {
+            ContextModel context_model(order);
+            Decode(context_model, fi, fo);
+        }
+    }
 };
+
+// The original format, and one with 32-bit code values whose legacy model
+// adapts over 2^24 symbols instead of freezing after 2^15.
+using BAC = BasicBAC<17, 15>;
+using BAC32 = BasicBAC<32, 24>;
+
+// Runs f on the BAC of the given code precision, so the caller's code is
+// instantiated once per configuration.
+template <class F>
+void WithBAC(int code_bits, int order, F&& f) {
+    if (code_bits == BAC::CODE_BITS) {
+        BAC bac(order);
+        f(bac);
+    } else if (code_bits == BAC32::CODE_BITS) {
+        BAC32 bac(order);
+        f(bac);
+    } else {
+        throw std::invalid_argument("BAC: code precision must be 17 or 32 bits");
+    }
+}
@@ -0,0 +1,140 @@
+// Per-symbol cost of the BAC frequency model against the previous linear
+// cumulative-table model.
+// Build: g++ -std=c++20 -O2 -pthread bac_model_bench.cpp -o bac_model_bench
+#include "bac.hpp"
+
+#include "chrono"
+#include "iomanip"
+#include "iostream"
+#include "random"
+#include "vector"
+
+
+namespace legacy {
+
+class LinearModel {
+private:
+    uint32_t FREQUENCY_BITS = 15;
+    uint32_t MAX_FREQUENCY = (uint32_t(1) << FREQUENCY_BITS) - 1;
+    bool is_full;
+public:
+    std::vector<uint32_t> cumulative_frequency;
+    LinearModel() {
+        reset();
+    }
+
+    void reset() {
+        cumulative_frequency.clear();
+        for (int i = 0; i <= 257; ++i) {
+            cumulative_frequency.push_back(i);
+        }
+        is_full = false;
+    }
+
+    void update(int c) {
+        for (int i = c + 1; i <= 257; ++i) {
+            ++cumulative_frequency[i];
+        }
+        if (cumulative_frequency[257] >= MAX_FREQUENCY) {
+            is_full = true;
+        }
+    }
+
+    Probability getProbability(int c) {
+        Probability prob =  {
+            cumulative_frequency[c],
+            cumulative_frequency[c + 1],
+            cumulative_frequency[257]
+        };
+        if (!is_full) {
+            update(c);
+        }
+        return prob;
+    }
+
+    Probability getChar(uint32_t scaled_value, int &c) {
+        for (int i = 0; i <= 256; ++i) {
+            if (scaled_value < cumulative_frequency[i + 1]) {
+                c = i;
+                Probability prob = {
+                    cumulative_frequency[i],
+                    cumulative_frequency[i+1],
+                    cumulative_frequency[257]
+                };
+
+                if (!is_full) {
+                    update(c);
+                }
+                return prob;
+            }
+        }
+        throw std::logic_error("Error in getChar");
+    }
+
+    uint32_t getCount() {
+        return cumulative_frequency[257];
+    }
+};
+
+} // namespace legacy
+
+
+// The model freezes after ~32K symbols, so it is reset every RESET_PERIOD
+// symbols to keep the adaptive update in the measurement.
+const size_t RESET_PERIOD = 16384;
+
+template <class Model>
+void run(const char* name, const std::vector<int>& symbols) {
+    Model model;
+    std::vector<uint32_t> lows(symbols.size());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        if (i % RESET_PERIOD == 0) {
+            model.reset();
+        }
+        lows[i] = model.getProbability(symbols[i]).low;
+    }
+    std::chrono::duration<double> enc = std::chrono::high_resolution_clock::now() - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        if (i % RESET_PERIOD == 0) {
+            model.reset();
+        }
+        int c;
+        model.getChar(lows[i], c);
+        if (c != symbols[i]) {
+            throw std::logic_error("bac_model_bench: decoded a different symbol");
+        }
+    }
+    std::chrono::duration<double> dec = std::chrono::high_resolution_clock::now() - start;
+
+    double n = symbols.size();
+    std::cout << std::setw(10) << name
+              << std::setw(18) << enc.count() * 1e9 / n
+              << std::setw(18) << dec.count() * 1e9 / n << '\n';
+}
+
+int main()
+{
+    const size_t count = size_t(1) << 24;
+    std::mt19937 rng(42);
+
+    std::vector<int> uniform(count), skewed(count);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::geometric_distribution<int> geo(0.05);
+    for (size_t i = 0; i < count; ++i) {
+        uniform[i] = byte(rng);
+        skewed[i] = 'a' + std::min(geo(rng), 150);
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto& [title, symbols] : {std::pair{"uniform", &uniform}, std::pair{"skewed", &skewed}}) {
+        std::cout << title << '\n' << std::setw(10) << "model"
+                  << std::setw(18) << "encode ns/sym" << std::setw(18) << "decode ns/sym" << '\n';
+        run<legacy::LinearModel>("linear", *symbols);
+        run<BAC::Model>("fenwick", *symbols);
+    }
+    return 0;
+}
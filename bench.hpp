@@ -0,0 +1,245 @@
+#pragma once
+
+#include "bitstream.hpp"
+
+#include "algorithm"
+#include "chrono"
+#include "cstdint"
+#include "cstring"
+#include "fstream"
+#include "functional"
+#include "iomanip"
+#include "iostream"
+#include "memory"
+#include "random"
+#include "sstream"
+#include "string"
+#include "vector"
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+
+// End-to-end codec benchmark behind `console --bench`. Every codec is run
+// over every case fully in memory (no disk I/O in the timings), checked to
+// round-trip, and reported as one JSON object per (case, codec) pair.
+class Benchmark {
+public:
+    using Codec = std::function<void(BitStream&, BitStream&)>;
+
+    // A case is one or more inputs that are coded independently; the
+    // small-files case uses many to expose per-stream overhead.
+    struct Case {
+        std::string name;
+        std::vector<std::vector<unsigned char>> inputs;
+    };
+
+    struct CodecEntry {
+        std::string name;
+        Codec compress;
+        Codec decompress;
+    };
+
+private:
+    std::vector<Case> cases;
+    std::vector<CodecEntry> codecs;
+
+    using Clock = std::chrono::steady_clock;
+
+    static std::vector<unsigned char> Run(const Codec& codec, const std::vector<unsigned char>& in) {
+        std::vector<unsigned char> out;
+        {
+            BitStream bi(std::make_unique<MemorySource>(in.data(), in.size()));
+            BitStream bo(std::make_unique<VectorSink>(out));
+            codec(bi, bo);
+        }
+        return out;
+    }
+
+    // Linux lets the peak RSS be reset per case, down to the current RSS;
+    // elsewhere the process-wide peak only grows, so a case shows just
+    // what it adds over every earlier one.
+    static void ResetPeakMemory() {
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        if (clear_refs) {
+            clear_refs << "5";
+        }
+    }
+
+    static long PeakMemoryKB() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.rfind("VmHWM:", 0) == 0) {
+                return std::stol(line.substr(6));
+            }
+        }
+#ifdef __unix__
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+            return usage.ru_maxrss;
+        }
+#endif
+        return -1;
+    }
+
+    static std::string Quote(const std::string& s) {
+        std::string res = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                res += '\\';
+                res += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                std::ostringstream hex;
+                hex << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c);
+                res += hex.str();
+            } else {
+                res += c;
+            }
+        }
+        return res + "\"";
+    }
+
+public:
+    void AddCodec(std::string name, Codec compress, Codec decompress) {
+        codecs.push_back(CodecEntry{std::move(name), std::move(compress), std::move(decompress)});
+    }
+
+    void AddCase(Case c) {
+        cases.push_back(std::move(c));
+    }
+
+    void AddFile(const std::string& path) {
+        std::ifstream f(path, std::ios::in | std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        AddCase(Case{path, {std::move(data)}});
+    }
+
+    // Deterministic inputs of roughly `size` bytes each: natural-language-like
+    // text, uniform random bytes, a repeated pattern with sparse edits,
+    // fixed-layout binary records, and a set of small text files.
+    void AddSyntheticCorpus(size_t size = size_t(4) << 20) {
+        std::mt19937 rng(12345);
+
+        std::vector<std::string> words;
+        const char* letters = "etaoinshrdlcumwfgypbvkjxqz";
+        for (int i = 0; i < 2000; ++i) {
+            std::string w;
+            int len = 2 + rng() % 9;
+            for (int j = 0; j < len; ++j) {
+                // skewed towards frequent letters
+                w += letters[std::min<int>(rng() % 26, rng() % 26)];
+            }
+            words.push_back(w);
+        }
+        auto text = [&](size_t n) {
+            std::vector<unsigned char> res;
+            std::geometric_distribution<int> zipfish(0.01);
+            while (res.size() < n) {
+                const std::string& w = words[std::min<int>(zipfish(rng), words.size() - 1)];
+                res.insert(res.end(), w.begin(), w.end());
+                unsigned r = rng() % 16;
+                res.push_back(r == 0 ? '\n' : r == 1 ? ',' : r == 2 ? '.' : ' ');
+            }
+            res.resize(n);
+            return res;
+        };
+
+        AddCase(Case{"text", {text(size)}});
+
+        std::vector<unsigned char> random(size);
+        for (unsigned char& c : random) {
+            c = static_cast<unsigned char>(rng());
+        }
+        AddCase(Case{"random", {std::move(random)}});
+
+        std::vector<unsigned char> pattern = text(1024);
+        std::vector<unsigned char> repetitive(size);
+        for (size_t i = 0; i < size; ++i) {
+            repetitive[i] = pattern[i % pattern.size()];
+        }
+        for (size_t i = 0; i < size / 4096; ++i) {
+            repetitive[rng() % size] = static_cast<unsigned char>(rng());
+        }
+        AddCase(Case{"repetitive", {std::move(repetitive)}});
+
+        // 16-byte records: sequence number, timestamp, small counter, float
+        std::vector<unsigned char> binary;
+        binary.reserve(size);
+        uint32_t timestamp = 1700000000;
+        for (uint32_t seq = 0; binary.size() + 16 <= size; ++seq) {
+            timestamp += rng() % 4;
+            float value = 20.0f + float(rng() % 1000) / 100.0f;
+            uint32_t counter = rng() % 64;
+            uint32_t fields[4] = {seq, timestamp, counter, 0};
+            std::memcpy(&fields[3], &value, sizeof(value));
+            for (uint32_t field : fields) {
+                for (int b = 0; b < 4; ++b) {
+                    binary.push_back(static_cast<unsigned char>(field >> (8 * b)));
+                }
+            }
+        }
+        AddCase(Case{"binary", {std::move(binary)}});
+
+        Case small{"small-files", {}};
+        for (size_t total = 0; total < size / 8;) {
+            small.inputs.push_back(text(64 + rng() % 4096));
+            total += small.inputs.back().size();
+        }
+        AddCase(std::move(small));
+    }
+
+    // Writes {"results": [...]} to `json`; returns false if any codec
+    // failed to reproduce its input.
+    bool Run(std::ostream& json) {
+        bool all_ok = true;
+        json << "{\n  \"results\": [";
+        bool first = true;
+        for (const Case& c : cases) {
+            for (const CodecEntry& codec : codecs) {
+                size_t in_bytes = 0;
+                size_t out_bytes = 0;
+                bool ok = true;
+                std::chrono::duration<double> compress_time(0);
+                std::chrono::duration<double> decompress_time(0);
+
+                // the corpus is already resident; count what coding adds to it
+                ResetPeakMemory();
+                long baseline_kb = PeakMemoryKB();
+                for (const std::vector<unsigned char>& input : c.inputs) {
+                    auto start = Clock::now();
+                    std::vector<unsigned char> packed = Run(codec.compress, input);
+                    auto mid = Clock::now();
+                    std::vector<unsigned char> unpacked = Run(codec.decompress, packed);
+                    auto end = Clock::now();
+
+                    compress_time += mid - start;
+                    decompress_time += end - mid;
+                    in_bytes += input.size();
+                    out_bytes += packed.size();
+                    ok = ok && unpacked == input;
+                }
+                long peak_kb = baseline_kb < 0 ? -1 : std::max(0L, PeakMemoryKB() - baseline_kb);
+                all_ok = all_ok && ok;
+
+                double mb = double(in_bytes) / (1 << 20);
+                json << (first ? "\n" : ",\n") << std::fixed << std::setprecision(3)
+                     << "    {\"case\": " << Quote(c.name)
+                     << ", \"algorithm\": " << Quote(codec.name)
+                     << ", \"inputs\": " << c.inputs.size()
+                     << ", \"input_bytes\": " << in_bytes
+                     << ", \"output_bytes\": " << out_bytes
+                     << ", \"ratio\": " << (out_bytes != 0 ? double(in_bytes) / out_bytes : 0.0)
+                     << ", \"compress_mb_s\": " << mb / std::max(compress_time.count(), 1e-9)
+                     << ", \"decompress_mb_s\": " << mb / std::max(decompress_time.count(), 1e-9)
+                     << ", \"peak_rss_delta_kb\": " << peak_kb
+                     << ", \"ok\": " << (ok ? "true" : "false") << "}";
+                json.flush();
+                first = false;
+            }
+        }
+        json << "\n  ]\n}\n";
+        return all_ok;
+    }
+};
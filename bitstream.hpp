@@ -1,205 +1,323 @@
 #pragma once
 
-#include "fstream"
+#include "byte_io.hpp"
+#include "stats.hpp"
+
 #include "string"
-#include "queue"
+#include "vector"
+#include "memory"
+#include "cstdint"
+#include "cstring"
+#include "algorithm"
+#include "stdexcept"
 #include "iostream"
 
 
 struct EOFReachedException {
-    
+
 };
 
+// Bits are packed MSB-first. Both directions keep a 64-bit accumulator
+// whose most significant bit is the next bit to be read/written. Reads go
+// straight over the chunks handed out by a ByteSource; writes are collected
+// in a contiguous buffer that is flushed to a ByteSink.
 class BitStream {
 private:
-    std::fstream f;
+    std::unique_ptr<ByteSource> source;
+    std::unique_ptr<ByteSink> sink;
 
-    std::string filename;
     std::string mode;
-    std::deque<unsigned char> buffer;
-    int bitsAvailable = 0;
+    // read: unconsumed bytes of the current chunk
+    const unsigned char* rpos = nullptr;
+    const unsigned char* rend = nullptr;
+    // write: filled bytes are [0, pos)
+    std::vector<unsigned char> buffer;
+    size_t pos = 0;
+
+    uint64_t acc = 0;
+    int accBits = 0;
 
-    const int BYTE_SIZE = 8;
-    const int MAX_SHIFT = BYTE_SIZE - 1;
-    const int BUFFER_MAX_SIZE = 131072; // 128 kb
+    static constexpr int BYTE_SIZE = 8;
+    static constexpr int ACC_SIZE = 64;
+
+    // Tops the accumulator up to at least 57 bits. With 8 bytes at hand the
+    // word is OR-ed in unconditionally: bits past accBits are the real bits
+    // of the following bytes, so OR-ing them in again later is a no-op.
+    void refill() {
+        if (rend - rpos >= 8) {
+            uint64_t word = 0;
+            for (int i = 0; i < 8; ++i) {
+                word = (word << BYTE_SIZE) | rpos[i];
+            }
+            acc |= word >> accBits;
+            int bytes = (ACC_SIZE - 1 - accBits) >> 3;
+            rpos += bytes;
+            accBits += bytes * BYTE_SIZE;
+            return;
+        }
+        while (accBits <= ACC_SIZE - BYTE_SIZE) {
+            if (rpos == rend && !fillBuffer()) {
+                break;
+            }
+            acc |= uint64_t(*rpos++) << (ACC_SIZE - BYTE_SIZE - accBits);
+            accBits += BYTE_SIZE;
+        }
+    }
+
+    void writeOut() {
+        STATS_PHASE(WRITE);
+        STATS_ADD(BYTES_OUT, pos);
+        sink->write(buffer.data(), pos);
+        pos = 0;
+    }
+
+    // Moves the whole bytes held in the write accumulator into the buffer;
+    // a trailing partial byte is padded with zero bits.
+    void drainAcc() {
+        while (accBits > 0) {
+            if (pos == buffer.size()) {
+                writeOut();
+            }
+            buffer[pos++] = static_cast<unsigned char>(acc >> (ACC_SIZE - BYTE_SIZE));
+            acc <<= BYTE_SIZE;
+            accBits -= BYTE_SIZE;
+        }
+        acc = 0;
+        accBits = 0;
+    }
+
+    void checkAligned() const {
+        if (accBits % BYTE_SIZE != 0) {
+            throw std::logic_error("BitStream: byte access on a partial byte");
+        }
+    }
 
 public:
+    static constexpr size_t BUFFER_MAX_SIZE = 131072; // 128 kb
+
     BitStream() {}
     BitStream(std::string filename, std::string mode) {
         this->mode = mode;
-        this->filename = filename;
         if (mode == "w") {
-            if (filename != "stdout") {
-                f.open(filename, std::ios::out | std::ios::trunc | std::ios::binary);
-            }
+            sink = OpenSink(filename);
+            buffer.resize(BUFFER_MAX_SIZE);
         } else if (mode == "r") {
-            f.open(filename, std::ios::in | std::ios::binary);
+            source = OpenSource(filename, BUFFER_MAX_SIZE);
         } else {
             throw std::runtime_error(std::string("BitStream incorrect mode: " + mode));
         }
     }
 
+    explicit BitStream(std::unique_ptr<ByteSource> source)
+    : source(std::move(source)), mode("r") {}
+
+    explicit BitStream(std::unique_ptr<ByteSink> sink)
+    : sink(std::move(sink)), mode("w"), buffer(BUFFER_MAX_SIZE) {}
+
+    BitStream(const BitStream&) = delete;
+    BitStream& operator=(const BitStream&) = delete;
+
+    // A sink that fails here has nowhere to report to; call finish() to
+    // find out.
     ~BitStream() {
-        if (mode == "w" && buffer.size() != 0) {
-            flushBuffer();
+        if (mode == "w") {
+            try {
+                drainAcc();
+                if (pos != 0) {
+                    writeOut();
+                }
+            } catch (...) {
+            }
         }
     }
 
-    void fillBuffer() {
-        char temp_buf[BUFFER_MAX_SIZE];
-        f.read(temp_buf, sizeof(temp_buf));
-        int readCnt = f.gcount();
-        for (int i = 0; i < readCnt; ++i) {
-            buffer.push_back(temp_buf[i]);
-        }
-        bitsAvailable += readCnt * BYTE_SIZE;
-        if (bitsAvailable == 0) {
-            throw EOFReachedException();
+    // Moves on to the next chunk of the source once the current one is
+    // consumed. Returns false once the source is exhausted.
+    bool fillBuffer() {
+        STATS_PHASE(READ);
+        size_t size = 0;
+        if (!source || !source->next(rpos, size)) {
+            rpos = rend = nullptr;
+            return false;
         }
+        STATS_ADD(BYTES_IN, size);
+        rend = rpos + size;
+        return true;
     }
 
-    void flushBuffer() {
-        if (buffer.size() > 0 && bitsAvailable >= BYTE_SIZE) {
-            std::vector<char> v;
-            std::copy(buffer.begin(), buffer.end(), std::back_inserter(v));
-            if (filename == "stdout") {
-                std::cout.write(reinterpret_cast<char*>(v.data()), v.size());
-            } else {
-                f.write(reinterpret_cast<char*>(v.data()), v.size());
-            }
-            buffer.clear();
-            bitsAvailable = 0;
-        }
+    bool rewindable() const {
+        return source && source->rewindable();
     }
 
-    uint32_t readBits(int bitsNeeded) {
-        uint32_t res = 0;
-        unsigned char tmp = 0;
-
-        if (bitsAvailable < bitsNeeded) {
-            fillBuffer();
+    // Starts reading the source over from its first byte.
+    void rewind() {
+        if (!rewindable()) {
+            throw std::logic_error("BitStream: input can't be rewound");
         }
+        source->rewind();
+        rpos = rend = nullptr;
+        acc = 0;
+        accBits = 0;
+    }
 
-        if (bitsAvailable < bitsNeeded) {
-            throw EOFReachedException();
+    // Skips (read) or zero-pads (write) the rest of a partial byte.
+    void alignToByte() {
+        int partial = accBits % BYTE_SIZE;
+        if (partial == 0) {
+            return;
         }
+        if (mode == "w") {
+            writeBits(0, BYTE_SIZE - partial);
+        } else {
+            readBits(partial);
+        }
+    }
 
-        // check if the last byte was partially used
-        if (bitsAvailable % BYTE_SIZE != 0) {
-            int bitsUnused = bitsAvailable & (BYTE_SIZE - 1); // == bitsAvailable % BYTE_SIZE
-            tmp = buffer.front();
-            buffer.pop_front();
-
-            if (bitsUnused > bitsNeeded) {
-                for (int i = 0; i < bitsNeeded; ++i) {
-                    --bitsUnused;
-
-                    res <<= 1;
-                    res |= (tmp >> bitsUnused & 1);
-                    tmp &= ~(1 << bitsUnused);
-                }
-                bitsAvailable -= bitsNeeded;
-                bitsNeeded = 0; 
-                buffer.push_front(tmp);
-
-            } else {
-                res += static_cast<uint32_t>(tmp);
-                bitsNeeded -= bitsUnused;
-                bitsAvailable -= bitsUnused;
-            }
+    // Writes everything out now, a partial byte padded with zeros, and
+    // closes the sink, so that a failing sink throws here rather than
+    // being lost in the destructor.
+    void finish() {
+        drainAcc();
+        if (pos != 0) {
+            flushBuffer();
+        }
+        sink->close();
+        if (!sink->good()) {
+            throw std::runtime_error("Output filestream is not available\n");
         }
+    }
 
-        while (bitsNeeded >= BYTE_SIZE) {
-            tmp = buffer.front();
-            buffer.pop_front();
-            
-            res <<= BYTE_SIZE;
-            res += static_cast<uint32_t>(tmp);
-            bitsNeeded -= BYTE_SIZE;
-            bitsAvailable -= BYTE_SIZE;
+    void flushBuffer() {
+        writeOut();
+        if (!sink->good()) {
+            throw std::runtime_error("Output filestream is not available\n");
         }
+    }
 
-        if (bitsNeeded < BYTE_SIZE && bitsNeeded > 0) {
-            tmp = buffer.front();
-            buffer.pop_front();
-            int tmpBits = BYTE_SIZE;
+    // 1 <= bitsNeeded <= 32
+    uint32_t readBits(int bitsNeeded) {
+        if (bitsNeeded == BYTE_SIZE && accBits == 0 && rpos != rend) {
+            acc = 0;
+            return *rpos++;
+        }
 
-            for (int i = 0; i < bitsNeeded; ++i) {
-                --tmpBits;
-                res <<= 1;
-                res |= (tmp >> tmpBits & 1);
-                tmp &= ~(1 << tmpBits);
+        if (accBits < bitsNeeded) {
+            refill();
+            if (accBits < bitsNeeded) {
+                throw EOFReachedException();
             }
-            
-            buffer.push_front(tmp);
-            bitsAvailable -= bitsNeeded;
         }
 
+        uint32_t res = static_cast<uint32_t>(acc >> (ACC_SIZE - bitsNeeded));
+        acc <<= bitsNeeded;
+        accBits -= bitsNeeded;
         return res;
     }
 
+    // 1 <= bits <= 32, bits of val above `bits` are ignored
     void writeBits(uint32_t val, int bits) {
-        unsigned char tmp = 0;
-        int tmpBits = 0;
-        if (bitsAvailable % BYTE_SIZE != 0) {
-            tmp = buffer.back();
-            buffer.pop_back();
-            tmpBits = bitsAvailable % BYTE_SIZE;
-
-            // fill the last char
-            if (bits <= BYTE_SIZE - tmpBits) {
-                tmp += static_cast<unsigned char> (val << (BYTE_SIZE - tmpBits - bits));
-                tmpBits = bits;
-                bits = 0;
-            } else {            
-                for (int i = 0, end = BYTE_SIZE - tmpBits; i < end; ++i) {
-                    // get i-th from msb bit value from val
-                    // set it to the non-used msb of temp
-                    tmp |= ((val >> (bits - i - 1) & 1) << (MAX_SHIFT - tmpBits));
-                    ++tmpBits;
-
-                    if (tmpBits == BYTE_SIZE) {
-                        buffer.push_back(tmp);
-                        bitsAvailable += (i+1);
-                        bits -= (i+1);
-                    }
-                }
-                tmp = 0;
-                tmpBits = 0;
+        if (bits == BYTE_SIZE && accBits == 0) {
+            if (pos == buffer.size()) {
+                flushBuffer();
             }
+            buffer[pos++] = static_cast<unsigned char>(val);
+            return;
         }
 
-        for (int i = 0; i < bits; ++i) {
-            // get i-th from msb bit value from val
-            // set it to the non-used msb of temp
-            tmp |= ((val >> (bits - i - 1) & 1) << (MAX_SHIFT - tmpBits));
-            ++tmpBits;
+        uint64_t v = uint64_t(val) & ((uint64_t(1) << bits) - 1);
+        acc |= v << (ACC_SIZE - accBits - bits);
+        accBits += bits;
 
-            if (tmpBits == BYTE_SIZE) {
-                if (buffer.size() == BUFFER_MAX_SIZE) {
-                    flushBuffer();
-                }
-                buffer.push_back(tmp);
-                tmp = 0;
-                tmpBits = 0;
-                bitsAvailable += BYTE_SIZE;
+        if (accBits >= 32) {
+            if (buffer.size() - pos < 4) {
+                flushBuffer();
             }
+            unsigned char* p = buffer.data() + pos;
+            p[0] = static_cast<unsigned char>(acc >> 56);
+            p[1] = static_cast<unsigned char>(acc >> 48);
+            p[2] = static_cast<unsigned char>(acc >> 40);
+            p[3] = static_cast<unsigned char>(acc >> 32);
+            pos += 4;
+            acc <<= 32;
+            accBits -= 32;
         }
+    }
 
-        if (!f) {
-            throw std::runtime_error("Output filestream is not available\n");
+    // Hands out n bytes of the output buffer to be filled in place by the
+    // caller. The stream must be byte-aligned.
+    unsigned char* reserveBytes(size_t n) {
+        checkAligned();
+        drainAcc();
+        if (buffer.size() - pos < n) {
+            flushBuffer();
+            if (buffer.size() < n) {
+                buffer.resize(n);
+            }
         }
+        unsigned char* p = buffer.data() + pos;
+        pos += n;
+        return p;
+    }
 
-        if (tmpBits != 0) {
-            if (buffer.size() == BUFFER_MAX_SIZE) {
-                flushBuffer();
+    // Byte-aligned bulk read; returns how many bytes were available.
+    size_t readBytes(unsigned char* dst, size_t n) {
+        checkAligned();
+        size_t done = 0;
+        while (done < n && accBits > 0) {
+            dst[done++] = static_cast<unsigned char>(acc >> (ACC_SIZE - BYTE_SIZE));
+            acc <<= BYTE_SIZE;
+            accBits -= BYTE_SIZE;
+        }
+        if (accBits == 0) {
+            acc = 0;
+        }
+        while (done < n) {
+            if (rpos == rend && !fillBuffer()) {
+                break;
             }
-            buffer.push_back(tmp);
-            bitsAvailable += tmpBits;
+            size_t k = std::min<size_t>(n - done, rend - rpos);
+            std::memcpy(dst + done, rpos, k);
+            rpos += k;
+            done += k;
+        }
+        return done;
+    }
+
+    // Byte-aligned bulk write.
+    void writeBytes(const unsigned char* src, size_t n) {
+        checkAligned();
+        drainAcc();
+        if (n >= buffer.size()) {
+            flushBuffer();
+            STATS_PHASE(WRITE);
+            STATS_ADD(BYTES_OUT, n);
+            sink->write(src, n);
+            return;
         }
+        if (buffer.size() - pos < n) {
+            flushBuffer();
+        }
+        std::memcpy(buffer.data() + pos, src, n);
+        pos += n;
     }
 
     int getByte() {
-        return f.get();
+        if (accBits == 0) {
+            if (rpos == rend && !fillBuffer()) {
+                return std::istream::traits_type::eof();
+            }
+            acc = 0;
+            return *rpos++;
+        }
+        if (accBits < BYTE_SIZE) {
+            refill();
+            if (accBits < BYTE_SIZE) {
+                return std::istream::traits_type::eof();
+            }
+        }
+        int res = static_cast<int>(acc >> (ACC_SIZE - BYTE_SIZE));
+        acc <<= BYTE_SIZE;
+        accBits -= BYTE_SIZE;
+        return res;
     }
 };
@@ -0,0 +1,321 @@
+#pragma once
+
+#include "bitstream.hpp"
+#include "thread_pool.hpp"
+
+#include "cstdint"
+#include "algorithm"
+#include "deque"
+#include "functional"
+#include "istream"
+#include "memory"
+#include "string"
+#include "tuple"
+#include "vector"
+#include "stdexcept"
+
+
+// Splits a stream into blocks that are coded independently, so they can be
+// compressed and decompressed on all cores. Layout:
+//
+//   magic (32) | block size (32) | frame* | index
+//   frame: raw size (32) | packed size (32) | packed bytes
+//   index: 0 (32) | index size (32) | frame offset (64)* | index size (32)
+//
+// Every block but the last holds block size raw bytes, so raw offset x is
+// in block x / block size, and the index, found from the end of the
+// stream, says where its frame starts.
+class BlockCodec {
+public:
+    // Codes everything readable from the first stream into the second.
+    using Codec = std::function<void(BitStream&, BitStream&)>;
+
+    static constexpr size_t DEFAULT_BLOCK_SIZE = size_t(4) << 20; // 4 MiB
+    static constexpr size_t MAX_BLOCK_SIZE = uint32_t(-1);
+
+private:
+    static constexpr uint32_t MAGIC = 0x424C4B31; // "BLK1"
+    static constexpr int WORD_SIZE = 32;
+    // No coder grows a block more than this (24-bit LZW codes for single
+    // bytes, with an entropy coder's overhead on top); anything larger is
+    // a corrupt frame header.
+    static constexpr uint64_t MAX_EXPANSION = 4;
+    static constexpr uint64_t EXPANSION_SLACK = 4096;
+    static constexpr size_t READ_STEP = size_t(1) << 20;
+    // the index size is a 32-bit byte count of 8-byte entries
+    static constexpr size_t MAX_FRAMES = uint32_t(-1) / 8;
+
+    size_t block_size;
+    unsigned threads;
+
+    using Block = std::vector<unsigned char>;
+
+    // How many blocks may be in flight: enough to keep every worker busy
+    // while the finished head of the queue is written out in order.
+    size_t window(const ThreadPool& pool) const {
+        return pool.size() * 2;
+    }
+
+    static uint64_t bigEndian(const unsigned char* p, int bytes) {
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; ++i) {
+            v = v << 8 | p[i];
+        }
+        return v;
+    }
+
+    static Block readAt(std::istream& in, uint64_t pos, size_t n) {
+        Block bytes(n);
+        in.clear();
+        in.seekg(pos);
+        in.read(reinterpret_cast<char*>(bytes.data()), n);
+        if (size_t(in.gcount()) != n) {
+            throw std::runtime_error("BlockCodec: truncated block");
+        }
+        return bytes;
+    }
+
+    // Absolute positions of the frames of the stream in [begin, end), read
+    // from its index.
+    static std::vector<uint64_t> frameOffsets(std::istream& in, uint64_t begin, uint64_t end) {
+        if (end - begin < 20) {
+            throw std::runtime_error("BlockCodec: corrupted index");
+        }
+        uint64_t size = bigEndian(readAt(in, end - 4, 4).data(), 4);
+        if (size % 8 != 0 || size > end - begin - 20) {
+            throw std::runtime_error("BlockCodec: corrupted index");
+        }
+        uint64_t at = end - 12 - size;
+        Block index = readAt(in, at, size + 8);
+        if (bigEndian(index.data(), 4) != 0 || bigEndian(index.data() + 4, 4) != size) {
+            throw std::runtime_error("BlockCodec: corrupted index");
+        }
+        std::vector<uint64_t> frames;
+        for (uint64_t i = 0; i < size / 8; ++i) {
+            uint64_t frame = begin + bigEndian(index.data() + 8 + 8 * i, 8);
+            if (frame >= at || (!frames.empty() && frame <= frames.back())) {
+                throw std::runtime_error("BlockCodec: corrupted index");
+            }
+            frames.push_back(frame);
+        }
+        return frames;
+    }
+
+    // Rejects a frame header no block of a stream of block_size bytes
+    // could have written.
+    static void checkFrame(uint64_t raw_size, uint64_t packed_size, uint64_t block_size) {
+        if (raw_size > block_size || packed_size > raw_size * MAX_EXPANSION + EXPANSION_SLACK) {
+            throw std::runtime_error("BlockCodec: corrupted frame");
+        }
+    }
+
+    // Reads n bytes, growing the buffer only as they arrive, so a size
+    // from a corrupt header costs no more memory than the input holds.
+    static void readPacked(BitStream& fi, Block& packed, size_t n) {
+        while (packed.size() < n) {
+            size_t at = packed.size();
+            size_t k = std::min(n - at, std::max(at, READ_STEP));
+            packed.resize(at + k);
+            if (fi.readBytes(packed.data() + at, k) != k) {
+                throw std::runtime_error("BlockCodec: truncated block");
+            }
+        }
+    }
+
+    static std::future<Block> run(ThreadPool& pool, const Codec& codec,
+                                  std::shared_ptr<Block> in, size_t expected_size) {
+        return pool.submit([&codec, in, expected_size]() {
+            Block out;
+            out.reserve(expected_size);
+            {
+                BitStream bi(std::make_unique<MemorySource>(in->data(), in->size()));
+                BitStream bo(std::make_unique<VectorSink>(out));
+                codec(bi, bo);
+            }
+            return out;
+        });
+    }
+
+public:
+    BlockCodec(size_t block_size = DEFAULT_BLOCK_SIZE, unsigned threads = 0)
+    : block_size(block_size), threads(threads) {
+        if (block_size == 0 || block_size > MAX_BLOCK_SIZE) {
+            throw std::invalid_argument("BlockCodec: block size out of range");
+        }
+    }
+
+    void Compress(std::string in, std::string out, const Codec& codec) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Compress(fi, fo, codec);
+    }
+
+    void Decompress(std::string in, std::string out, const Codec& codec) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Decompress(fi, fo, codec);
+    }
+
+    void Compress(BitStream& fi, BitStream& fo, const Codec& codec) {
+        ThreadPool pool(threads);
+        std::deque<std::pair<size_t, std::future<Block>>> inflight;
+        std::vector<uint64_t> frames;
+        uint64_t written = 8;
+        size_t blocks = 0;
+
+        auto writeFrame = [&]() {
+            Block packed = inflight.front().second.get();
+            frames.push_back(written);
+            written += 8 + packed.size();
+            fo.writeBits(inflight.front().first, WORD_SIZE);
+            fo.writeBits(packed.size(), WORD_SIZE);
+            fo.writeBytes(packed.data(), packed.size());
+            inflight.pop_front();
+        };
+
+        fo.writeBits(MAGIC, WORD_SIZE);
+        fo.writeBits(block_size, WORD_SIZE);
+
+        while (true) {
+            auto block = std::make_shared<Block>(block_size);
+            size_t n = fi.readBytes(block->data(), block_size);
+            if (n == 0) {
+                break;
+            }
+            block->resize(n);
+            if (++blocks > MAX_FRAMES) {
+                throw std::runtime_error("BlockCodec: too many blocks for the index, use a larger block size");
+            }
+            inflight.emplace_back(n, run(pool, codec, block, n));
+            if (inflight.size() >= window(pool)) {
+                writeFrame();
+            }
+            if (n < block_size) {
+                break;
+            }
+        }
+        while (!inflight.empty()) {
+            writeFrame();
+        }
+
+        uint32_t index_size = frames.size() * 8;
+        fo.writeBits(0, WORD_SIZE);
+        fo.writeBits(index_size, WORD_SIZE);
+        for (uint64_t frame : frames) {
+            fo.writeBits(static_cast<uint32_t>(frame >> 32), WORD_SIZE);
+            fo.writeBits(static_cast<uint32_t>(frame), WORD_SIZE);
+        }
+        fo.writeBits(index_size, WORD_SIZE);
+    }
+
+    void Decompress(BitStream& fi, BitStream& fo, const Codec& codec) {
+        uint32_t magic = 0;
+        uint32_t stream_block_size = 0;
+        try {
+            magic = fi.readBits(WORD_SIZE);
+            stream_block_size = fi.readBits(WORD_SIZE); // bounds the frames
+        } catch (EOFReachedException& ex) {
+        }
+        if (magic != MAGIC) {
+            throw std::runtime_error("BlockCodec: input is not a block stream");
+        }
+
+        ThreadPool pool(threads);
+        std::deque<std::pair<size_t, std::future<Block>>> inflight;
+
+        auto writeBlock = [&]() {
+            Block raw = inflight.front().second.get();
+            if (raw.size() != inflight.front().first) {
+                throw std::runtime_error("BlockCodec: block decoded to a wrong size");
+            }
+            fo.writeBytes(raw.data(), raw.size());
+            inflight.pop_front();
+        };
+
+        while (true) {
+            uint32_t raw_size, packed_size;
+            try {
+                raw_size = fi.readBits(WORD_SIZE);
+                packed_size = fi.readBits(WORD_SIZE);
+            } catch (EOFReachedException& ex) {
+                break;
+            }
+            if (raw_size == 0) {
+                // the index, not needed for a full decode
+                Block index;
+                readPacked(fi, index, size_t(packed_size) + 4);
+                break;
+            }
+            checkFrame(raw_size, packed_size, stream_block_size);
+            auto packed = std::make_shared<Block>();
+            readPacked(fi, *packed, packed_size);
+            inflight.emplace_back(raw_size, run(pool, codec, packed, raw_size));
+            if (inflight.size() >= window(pool)) {
+                writeBlock();
+            }
+        }
+        while (!inflight.empty()) {
+            writeBlock();
+        }
+    }
+
+    // Decodes raw bytes [offset, offset + length) of the block stream that
+    // `in` holds in [begin, end). Only the blocks overlapping the range are
+    // read and decoded; a range running past the end is cut short.
+    void DecompressRange(std::istream& in, uint64_t begin, uint64_t end,
+                         uint64_t offset, uint64_t length, BitStream& fo, const Codec& codec) {
+        if (end < begin + 8) {
+            throw std::runtime_error("BlockCodec: input is not a block stream");
+        }
+        Block head = readAt(in, begin, 8);
+        if (bigEndian(head.data(), 4) != MAGIC) {
+            throw std::runtime_error("BlockCodec: input is not a block stream");
+        }
+        uint64_t stream_block_size = bigEndian(head.data() + 4, 4);
+        if (stream_block_size == 0) {
+            throw std::runtime_error("BlockCodec: corrupted header");
+        }
+        std::vector<uint64_t> frames = frameOffsets(in, begin, end);
+
+        uint64_t range_end = length > uint64_t(-1) - offset ? uint64_t(-1) : offset + length;
+        uint64_t first = offset / stream_block_size;
+        // rounded up without overflowing for a range that runs to the end
+        uint64_t last = range_end == 0 ? 0 : std::min<uint64_t>(frames.size(), (range_end - 1) / stream_block_size + 1);
+
+        ThreadPool pool(threads);
+        std::deque<std::tuple<uint64_t, uint32_t, std::future<Block>>> inflight;
+
+        auto writeBlock = [&]() {
+            auto& [b, raw_size, result] = inflight.front();
+            uint64_t start = b * stream_block_size;
+            Block raw = result.get();
+            if (raw.size() != raw_size) {
+                throw std::runtime_error("BlockCodec: block decoded to a wrong size");
+            }
+            inflight.pop_front();
+            uint64_t from = std::max(offset, start);
+            uint64_t to = std::min(range_end, start + raw.size());
+            if (from < to) {
+                fo.writeBytes(raw.data() + (from - start), to - from);
+            }
+        };
+
+        for (uint64_t b = first; b < last; ++b) {
+            Block header = readAt(in, frames[b], 8);
+            uint32_t raw_size = bigEndian(header.data(), 4);
+            uint32_t packed_size = bigEndian(header.data() + 4, 4);
+            checkFrame(raw_size, packed_size, stream_block_size);
+            if (frames[b] + 8 + packed_size > end) {
+                throw std::runtime_error("BlockCodec: corrupted index");
+            }
+            auto packed = std::make_shared<Block>(readAt(in, frames[b] + 8, packed_size));
+            inflight.emplace_back(b, raw_size, run(pool, codec, packed, raw_size));
+            if (inflight.size() >= window(pool)) {
+                writeBlock();
+            }
+        }
+        while (!inflight.empty()) {
+            writeBlock();
+        }
+    }
+};
@@ -0,0 +1,368 @@
+#pragma once
+
+#include "algorithm"
+#include "cstdio"
+#include "fstream"
+#include "iostream"
+#include "string"
+#include "vector"
+#include "cstdint"
+#include "memory"
+#include "stdexcept"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ARCHIVER_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Where a BitStream reads its bytes from. A source hands out non-empty
+// chunks that stay valid until the next call, which lets memory-backed
+// sources be read in place without copying.
+class ByteSource {
+public:
+    virtual ~ByteSource() {}
+
+    // Makes the next chunk available; returns false once the input is exhausted.
+    virtual bool next(const unsigned char*& data, size_t& size) = 0;
+
+    // Sources that can start over from their first byte; used by two-pass
+    // codecs.
+    virtual bool rewindable() const {
+        return false;
+    }
+
+    virtual void rewind() {
+        throw std::logic_error("ByteSource: rewind is not supported");
+    }
+};
+
+// Where a BitStream writes its bytes to.
+class ByteSink {
+public:
+    virtual ~ByteSink() {}
+
+    virtual void write(const unsigned char* data, size_t size) = 0;
+
+    // false once the underlying output has failed
+    virtual bool good() const {
+        return true;
+    }
+
+    // Called after the last write: pushes out whatever the sink still
+    // buffers, so that good() covers every byte written.
+    virtual void close() {}
+};
+
+
+class FileSource : public ByteSource {
+private:
+    std::ifstream f;
+    std::vector<unsigned char> buffer;
+
+public:
+    // An input that can't be opened must not read as an empty one, or it
+    // would be archived as empty and then removed.
+    FileSource(const std::string& filename, size_t buffer_size)
+    : f(filename, std::ios::in | std::ios::binary), buffer(buffer_size) {
+        if (!f.is_open()) {
+            throw std::runtime_error("cannot open " + filename);
+        }
+    }
+
+    bool next(const unsigned char*& data, size_t& size) override {
+        f.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+        if (f.bad()) {
+            throw std::runtime_error("read failed");
+        }
+        data = buffer.data();
+        size = f.gcount();
+        return size != 0;
+    }
+};
+
+// Maps a regular file and hands the whole mapping out as one chunk, so the
+// reader scans the page cache in place with no copies. Anything that can't
+// be mapped (pipes, devices, empty files) is read through a FileSource.
+class MappedFileSource : public ByteSource {
+private:
+    const unsigned char* map = nullptr;
+    size_t map_size = 0;
+    bool done = false;
+    std::unique_ptr<FileSource> fallback;
+
+public:
+    MappedFileSource(const std::string& filename, size_t buffer_size) {
+#ifdef ARCHIVER_HAVE_MMAP
+        // only files that open but can't be mapped fall back to reading
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + filename);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+                map = static_cast<const unsigned char*>(p);
+                map_size = st.st_size;
+            }
+        }
+        ::close(fd);
+#endif
+        if (map == nullptr) {
+            fallback = std::make_unique<FileSource>(filename, buffer_size);
+        }
+    }
+
+    MappedFileSource(const MappedFileSource&) = delete;
+    MappedFileSource& operator=(const MappedFileSource&) = delete;
+
+    ~MappedFileSource() {
+#ifdef ARCHIVER_HAVE_MMAP
+        if (map != nullptr) {
+            ::munmap(const_cast<unsigned char*>(map), map_size);
+        }
+#endif
+    }
+
+    bool next(const unsigned char*& data, size_t& size) override {
+        if (fallback) {
+            return fallback->next(data, size);
+        }
+        if (done) {
+            return false;
+        }
+        done = true;
+        data = map;
+        size = map_size;
+        return true;
+    }
+
+    bool rewindable() const override {
+        return !fallback;
+    }
+
+    void rewind() override {
+        if (fallback) {
+            ByteSource::rewind();
+        }
+        done = false;
+    }
+};
+
+class FileSink : public ByteSink {
+private:
+    std::ofstream f;
+
+public:
+    FileSink(const std::string& filename)
+    : f(filename, std::ios::out | std::ios::trunc | std::ios::binary) {}
+
+    void write(const unsigned char* data, size_t size) override {
+        f.write(reinterpret_cast<const char*>(data), size);
+    }
+
+    bool good() const override {
+        return bool(f);
+    }
+
+    void close() override {
+        f.flush();
+    }
+};
+
+// Lets the archiver read from a pipe.
+class StdinSource : public ByteSource {
+private:
+    std::vector<unsigned char> buffer;
+
+public:
+    explicit StdinSource(size_t buffer_size) : buffer(buffer_size) {}
+
+    bool next(const unsigned char*& data, size_t& size) override {
+        data = buffer.data();
+        size = std::fread(buffer.data(), 1, buffer.size(), stdin);
+        return size != 0;
+    }
+};
+
+// "stdin" and "-" name the standard input
+inline bool IsStdin(const std::string& filename) {
+    return filename == "stdin" || filename == "-";
+}
+
+class StdoutSink : public ByteSink {
+public:
+    void write(const unsigned char* data, size_t size) override {
+        std::cout.write(reinterpret_cast<const char*>(data), size);
+    }
+
+    bool good() const override {
+        return bool(std::cout);
+    }
+
+    void close() override {
+        std::cout.flush();
+    }
+};
+
+// Discards everything; used to test an archive without writing it out.
+class NullSink : public ByteSink {
+public:
+    void write(const unsigned char*, size_t) override {}
+};
+
+// "stdout" or a file name
+inline std::unique_ptr<ByteSink> OpenSink(const std::string& filename) {
+    if (filename == "stdout") {
+        return std::make_unique<StdoutSink>();
+    }
+    return std::make_unique<FileSink>(filename);
+}
+
+// The standard input or a mapped file
+inline std::unique_ptr<ByteSource> OpenSource(const std::string& filename, size_t buffer_size) {
+    if (IsStdin(filename)) {
+        return std::make_unique<StdinSource>(buffer_size);
+    }
+    return std::make_unique<MappedFileSource>(filename, buffer_size);
+}
+
+// Reads a caller-owned buffer in place; the buffer must outlive the source.
+class MemorySource : public ByteSource {
+private:
+    const unsigned char* data;
+    size_t size;
+    bool done = false;
+
+public:
+    MemorySource(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+    bool next(const unsigned char*& chunk, size_t& chunk_size) override {
+        if (done || size == 0) {
+            return false;
+        }
+        done = true;
+        chunk = data;
+        chunk_size = size;
+        return true;
+    }
+
+    bool rewindable() const override {
+        return true;
+    }
+
+    void rewind() override {
+        done = false;
+    }
+};
+
+// Appends to a caller-owned vector.
+class VectorSink : public ByteSink {
+private:
+    std::vector<unsigned char>& out;
+
+public:
+    VectorSink(std::vector<unsigned char>& out) : out(out) {}
+
+    void write(const unsigned char* data, size_t size) override {
+        out.insert(out.end(), data, data + size);
+    }
+};
+
+// Passes on only bytes [offset, offset + length) of what is written to it.
+class RangeSink : public ByteSink {
+private:
+    std::unique_ptr<ByteSink> sink;
+    uint64_t offset;
+    uint64_t end;
+    uint64_t pos = 0;
+
+public:
+    RangeSink(std::unique_ptr<ByteSink> sink, uint64_t offset, uint64_t length)
+    : sink(std::move(sink)), offset(offset),
+      end(length > uint64_t(-1) - offset ? uint64_t(-1) : offset + length) {}
+
+    void write(const unsigned char* data, size_t size) override {
+        uint64_t from = std::max(pos, offset);
+        uint64_t to = std::min(pos + size, end);
+        if (from < to) {
+            sink->write(data + (from - pos), to - from);
+        }
+        pos += size;
+    }
+
+    bool good() const override {
+        return sink->good();
+    }
+
+    void close() override {
+        sink->close();
+    }
+};
+
+// Passes a source through except for its last `keep` bytes, which are held
+// back and available from held() once the source is exhausted. Lets a
+// reader run to EOF without consuming a trailer. Chunks of at least `keep`
+// bytes are still handed out in place.
+class HoldBackSource : public ByteSource {
+private:
+    std::unique_ptr<ByteSource> source;
+    size_t keep;
+    std::vector<unsigned char> tail;    // the last bytes seen, at most keep once past them
+    std::vector<unsigned char> staging; // released part of tail
+    const unsigned char* queued = nullptr;
+    size_t queued_size = 0;
+
+public:
+    HoldBackSource(std::unique_ptr<ByteSource> source, size_t keep)
+    : source(std::move(source)), keep(keep) {}
+
+    bool next(const unsigned char*& data, size_t& size) override {
+        if (queued_size != 0) {
+            data = queued;
+            size = queued_size;
+            queued_size = 0;
+            return true;
+        }
+        const unsigned char* chunk;
+        size_t chunk_size;
+        while (source->next(chunk, chunk_size)) {
+            if (chunk_size >= keep) {
+                // all of tail comes before the new last `keep` bytes
+                staging.swap(tail);
+                tail.assign(chunk + chunk_size - keep, chunk + chunk_size);
+                queued = chunk;
+                queued_size = chunk_size - keep;
+                if (!staging.empty()) {
+                    data = staging.data();
+                    size = staging.size();
+                    return true;
+                }
+                if (queued_size != 0) {
+                    return next(data, size);
+                }
+            } else {
+                tail.insert(tail.end(), chunk, chunk + chunk_size);
+                if (tail.size() > keep) {
+                    size_t n = tail.size() - keep;
+                    staging.assign(tail.begin(), tail.begin() + n);
+                    tail.erase(tail.begin(), tail.begin() + n);
+                    data = staging.data();
+                    size = n;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // the held-back bytes; fewer than `keep` if the whole source was shorter
+    const std::vector<unsigned char>& held() const {
+        return tail;
+    }
+};
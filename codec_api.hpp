@@ -0,0 +1,212 @@
+#pragma once
+
+#include "bitstream.hpp"
+#include "pipeline.hpp"
+
+#include "cstddef"
+#include "cstring"
+#include "exception"
+#include "functional"
+#include "memory"
+#include "mutex"
+#include "span"
+#include "stdexcept"
+#include "thread"
+#include "vector"
+
+
+// In-memory front end of the codecs for embedding them in a service: no
+// file names, no temporary files. A codec is any
+// void(BitStream& in, BitStream& out), usually made with
+//
+//   auto lzw = CompressorOf<LZW>(16);
+//   auto unbac = DecompressorOf<BAC>(2);
+//
+// and is run either over a whole buffer (Encode) or incrementally, a piece
+// at a time, through a StreamCoder.
+using Codec = std::function<void(BitStream&, BitStream&)>;
+
+template <class C, class... Args>
+Codec CompressorOf(Args... args) {
+    return [args...](BitStream& fi, BitStream& fo) { C(args...).Compress(fi, fo); };
+}
+
+template <class C, class... Args>
+Codec DecompressorOf(Args... args) {
+    return [args...](BitStream& fi, BitStream& fo) { C(args...).Decompress(fi, fo); };
+}
+
+// Appends to a caller-owned vector of std::byte.
+class ByteVectorSink : public ByteSink {
+private:
+    std::vector<std::byte>& out;
+
+public:
+    ByteVectorSink(std::vector<std::byte>& out) : out(out) {}
+
+    void write(const unsigned char* data, size_t size) override {
+        const std::byte* p = reinterpret_cast<const std::byte*>(data);
+        out.insert(out.end(), p, p + size);
+    }
+};
+
+// Fills a caller-provided buffer and throws std::length_error once it is full.
+class SpanSink : public ByteSink {
+private:
+    std::span<std::byte> out;
+    size_t used = 0;
+
+public:
+    SpanSink(std::span<std::byte> out) : out(out) {}
+
+    void write(const unsigned char* data, size_t size) override {
+        if (size > out.size() - used) {
+            throw std::length_error("SpanSink: output buffer too small");
+        }
+        std::memcpy(out.data() + used, data, size);
+        used += size;
+    }
+
+    size_t size() const {
+        return used;
+    }
+};
+
+inline std::unique_ptr<ByteSource> SpanSource(std::span<const std::byte> in) {
+    return std::make_unique<MemorySource>(reinterpret_cast<const unsigned char*>(in.data()), in.size());
+}
+
+// Appends the coded `in` to `out`.
+inline void Encode(const Codec& codec, std::span<const std::byte> in, std::vector<std::byte>& out) {
+    BitStream fi(SpanSource(in));
+    BitStream fo(std::make_unique<ByteVectorSink>(out));
+    codec(fi, fo);
+    fo.finish();
+}
+
+inline std::vector<std::byte> Encode(const Codec& codec, std::span<const std::byte> in) {
+    std::vector<std::byte> out;
+    Encode(codec, in, out);
+    return out;
+}
+
+// Codes `in` into the caller's buffer and returns the size used; throws
+// std::length_error if it doesn't fit.
+inline size_t Encode(const Codec& codec, std::span<const std::byte> in, std::span<std::byte> out) {
+    auto sink = std::make_unique<SpanSink>(out);
+    SpanSink& written = *sink;
+    {
+        BitStream fi(SpanSource(in));
+        BitStream fo(std::move(sink));
+        codec(fi, fo);
+        fo.finish();
+    }
+    return written.size();
+}
+
+// Runs a codec over input that arrives in pieces, keeping its state between
+// calls. The codec works on its own thread and reads the pieces from a
+// bounded ByteChannel, so push() blocks only while `depth` pieces are
+// waiting; whatever output is ready is handed back from every call.
+//
+//   StreamCoder enc(CompressorOf<BAC>());
+//   for (auto piece : payload) enc.push(piece, out);
+//   enc.finish(out);
+//
+// An error of the codec is rethrown from the next push() or finish().
+class StreamCoder {
+private:
+    // collects the codec's output for the caller's thread
+    class Mailbox : public ByteSink {
+    private:
+        StreamCoder& owner;
+
+    public:
+        Mailbox(StreamCoder& owner) : owner(owner) {}
+
+        void write(const unsigned char* data, size_t size) override {
+            const std::byte* p = reinterpret_cast<const std::byte*>(data);
+            std::lock_guard<std::mutex> lock(owner.mutex);
+            owner.ready.insert(owner.ready.end(), p, p + size);
+        }
+    };
+
+    ByteChannel channel;
+    std::mutex mutex;
+    std::vector<std::byte> ready;
+    std::exception_ptr error;
+    std::thread worker;
+    bool joined = false;
+    bool finished = false;
+
+    void join() {
+        if (!joined) {
+            worker.join();
+            joined = true;
+        }
+    }
+
+    void collect(std::vector<std::byte>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out.insert(out.end(), ready.begin(), ready.end());
+        ready.clear();
+    }
+
+public:
+    explicit StreamCoder(Codec codec, size_t depth = 4) : channel(depth) {
+        STATS_CONTEXT(stats_context);
+        worker = std::thread([this, codec = std::move(codec) STATS_CAPTURE(stats_context)]() {
+            STATS_ADOPT(stats_context);
+            try {
+                BitStream fi(std::make_unique<ChannelSource>(channel));
+                BitStream fo(std::make_unique<Mailbox>(*this));
+                codec(fi, fo);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            // a codec that stops early must not leave push() blocked
+            channel.cancel();
+        });
+    }
+
+    StreamCoder(const StreamCoder&) = delete;
+    StreamCoder& operator=(const StreamCoder&) = delete;
+
+    // Abandons an unfinished stream.
+    ~StreamCoder() {
+        channel.cancel();
+        join();
+    }
+
+    // Feeds the next piece of input and appends the output ready so far.
+    void push(std::span<const std::byte> in, std::vector<std::byte>& out) {
+        if (finished) {
+            throw std::logic_error("StreamCoder: push after finish");
+        }
+        if (!in.empty()) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(in.data());
+            if (!channel.push(std::vector<unsigned char>(p, p + in.size()))) {
+                // the codec has stopped: failed, or done before its input was
+                join();
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+        }
+        collect(out);
+    }
+
+    // Ends the input, waits for the codec and appends the rest of the output.
+    void finish(std::vector<std::byte>& out) {
+        if (finished) {
+            throw std::logic_error("StreamCoder: finish called twice");
+        }
+        finished = true;
+        channel.close();
+        join();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        collect(out);
+    }
+};
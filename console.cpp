@@ -1,11 +1,24 @@
 #include "lzw.hpp"
 #include "bac.hpp"
+#include "range_coder.hpp"
+#include "rans.hpp"
+#include "lzss.hpp"
+#include "auto_codec.hpp"
+#include "block_codec.hpp"
+#include "solid_archive.hpp"
+#include "archive_format.hpp"
+#include "crc32c.hpp"
+#include "pipeline.hpp"
+#include "thread_pool.hpp"
+#include "bench.hpp"
 #include "timer_guard.hpp"
 
 #include "iostream"
 #include "string"
 #include "filesystem"
 #include "algorithm"
+#include "sstream"
+#include "iomanip"
 
 namespace fs = std::filesystem;
 
@@ -17,19 +30,43 @@ const int RECURSIVE_BIT      = 1<<4;
 const int TEST_INTEGRITY_BIT = 1<<5;
 const int USE_BAC_BIT        = 1<<6;
 const int USE_LZW_AND_BAC_BIT= 1<<7;
+const int USE_RANGE_BIT      = 1<<8;
+const int BLOCK_MODE_BIT     = 1<<9;
+const int USE_RANS_BIT       = 1<<10;
+const int SOLID_BIT          = 1<<11;
+const int LIST_MEMBERS_BIT   = 1<<12;
+const int USE_LZSS_BIT       = 1<<13;
+const int USE_AUTO_BIT       = 1<<14;
+const int DEDUP_BIT          = 1<<15;
 
 
-struct IntegrityError {
-
+struct ArchiverOptions {
+    size_t block_size = BlockCodec::DEFAULT_BLOCK_SIZE;
+    unsigned threads = 0; // 0: one per hardware thread
+    int order = BAC::LEGACY_ORDER; // model order of BAC and the range coder
+    int lzw_bits = LZW::DEFAULT_MAX_BITS; // maximum LZW code width
+    int bac_bits = BAC::CODE_BITS; // BAC code value precision, BAC or BAC32
+    int level = LZSS::DEFAULT_LEVEL; // LZSS speed/ratio trade-off, not needed to decode
+    std::string extract; // the one member to extract from a solid archive
+    bool range = false; // decompress only raw bytes [range_offset, range_offset + range_length)
+    uint64_t range_offset = 0;
+    uint64_t range_length = 0;
 };
 
 
 class ArchiverData {
 private:
-    enum class Algorithm {
-        LZW,
-        BAC,
-        LZW_BAC
+    // values are stored in the archive header
+    enum class Algorithm : uint32_t {
+        LZW = 0,
+        BAC = 1,
+        LZW_BAC = 2,
+        RANGE = 3,
+        RANS = 4,
+        LZW_RANS = 5,
+        LZSS = 6,
+        LZSS_BAC = 7,
+        AUTO = 8
     };
 
     enum class Mode {
@@ -38,10 +75,13 @@ private:
     };
 
     const int flag;
+    ArchiverOptions options;
+    std::ostream& out;
     std::string filename;
     std::string output_name;
     Algorithm algo;
     Mode mode;
+    bool blocks;
 
     void SetOutputName() {
         if (flag & STD_OUTPUT_BIT) {
@@ -52,12 +92,37 @@ private:
             output_name = output_name.substr(0, output_name.find('.'));
             output_name += ".res";
         }
+        else if (flag & SOLID_BIT) {
+            output_name = filename;
+            while (output_name.size() > 1 && output_name.back() == '/') {
+                output_name.pop_back();
+            }
+            output_name += ".solid";
+        }
         else {
-            if (flag & USE_BAC_BIT) {
+            if (flag & USE_AUTO_BIT) {
+                output_name = filename + ".auto";
+            }
+            else if (flag & USE_BAC_BIT) {
                 output_name = filename + ".bac";
             } 
+            else if (flag & USE_LZW_AND_BAC_BIT && flag & USE_LZSS_BIT) {
+                output_name = filename + ".lzss.bac";
+            }
+            else if (flag & USE_LZW_AND_BAC_BIT && flag & USE_RANS_BIT) {
+                output_name = filename + ".lzw.rans";
+            }
             else if (flag & USE_LZW_AND_BAC_BIT) {
-                output_name = filename;
+                output_name = filename + ".lzw.bac";
+            }
+            else if (flag & USE_RANGE_BIT) {
+                output_name = filename + ".rc";
+            }
+            else if (flag & USE_RANS_BIT) {
+                output_name = filename + ".rans";
+            }
+            else if (flag & USE_LZSS_BIT) {
+                output_name = filename + ".lzss";
             }
             else {
                 output_name = filename + ".lzw";
@@ -66,82 +131,439 @@ private:
     }
 
     void EstablishOptions() {
-        if (flag & USE_BAC_BIT) {
+        if (flag & USE_AUTO_BIT) {
+            algo = Algorithm::AUTO;
+        } else if (flag & USE_BAC_BIT) {
             algo = Algorithm::BAC;
+        } else if (flag & USE_LZW_AND_BAC_BIT && flag & USE_LZSS_BIT) {
+            // -9 with LZSS instead of LZW as the first stage
+            algo = Algorithm::LZSS_BAC;
+        } else if (flag & USE_LZW_AND_BAC_BIT && flag & USE_RANS_BIT) {
+            // -9 with rANS instead of BAC as the entropy stage
+            algo = Algorithm::LZW_RANS;
         } else if (flag & USE_LZW_AND_BAC_BIT) {
             algo = Algorithm::LZW_BAC;
+        } else if (flag & USE_RANGE_BIT) {
+            algo = Algorithm::RANGE;
+        } else if (flag & USE_RANS_BIT) {
+            algo = Algorithm::RANS;
+        } else if (flag & USE_LZSS_BIT) {
+            algo = Algorithm::LZSS;
         } else {
             algo = Algorithm::LZW;
         }
 
-        if (flag & DECOMPRESS_BIT) {
+        if (flag & (DECOMPRESS_BIT | TEST_INTEGRITY_BIT)) {
             mode = Mode::Decompress;
         } else {
             mode = Mode::Compress;
         }
+        // the analyzer holds what it codes in memory, so it goes block by block
+        blocks = flag & BLOCK_MODE_BIT || algo == Algorithm::AUTO;
     }
 
-    void ProcessFile() {
-        if (mode == Mode::Compress) {
-            if (algo == Algorithm::LZW) {
-                LZW lzw;
-                lzw.Compress(filename, output_name);
+    // BAC in the configured precision; each one is coded by its own
+    // instantiation of the coder.
+    BlockCodec::Codec BacCompressor() const {
+        int order = options.order;
+        int bac_bits = options.bac_bits;
+        return [order, bac_bits](BitStream& fi, BitStream& fo) {
+            WithBAC(bac_bits, order, [&](auto& bac) { bac.Compress(fi, fo); });
+        };
+    }
+
+    BlockCodec::Codec BacDecompressor() const {
+        int order = options.order;
+        int bac_bits = options.bac_bits;
+        return [order, bac_bits](BitStream& fi, BitStream& fo) {
+            WithBAC(bac_bits, order, [&](auto& bac) { bac.Decompress(fi, fo); });
+        };
+    }
+
+    BlockCodec::Codec Compressor() const {
+        int order = options.order;
+        int bits = options.lzw_bits;
+        int bac_bits = options.bac_bits;
+        int level = options.level;
+        auto bac = BacCompressor();
+        if (algo == Algorithm::BAC) {
+            return bac;
+        }
+        else if (algo == Algorithm::RANGE) {
+            return [order](BitStream& fi, BitStream& fo) { RangeCoder(order).Compress(fi, fo); };
+        }
+        else if (algo == Algorithm::LZW_BAC) {
+            return [bac, bits](BitStream& fi, BitStream& fo) {
+                Pipeline(
+                    [bits](BitStream& in, BitStream& out) { LZW(bits).Compress(in, out); },
+                    bac
+                ).Run(fi, fo);
+            };
+        }
+        else if (algo == Algorithm::RANS) {
+            return [](BitStream& fi, BitStream& fo) { RANS().Compress(fi, fo); };
+        }
+        else if (algo == Algorithm::LZW_RANS) {
+            return [bits](BitStream& fi, BitStream& fo) {
+                Pipeline(
+                    [bits](BitStream& in, BitStream& out) { LZW(bits).Compress(in, out); },
+                    [](BitStream& in, BitStream& out) { RANS().Compress(in, out); }
+                ).Run(fi, fo);
+            };
+        }
+        else if (algo == Algorithm::LZSS) {
+            return [level](BitStream& fi, BitStream& fo) { LZSS(level).Compress(fi, fo); };
+        }
+        else if (algo == Algorithm::AUTO) {
+            return [order, bits, bac_bits](BitStream& fi, BitStream& fo) {
+                AutoCodec(order, bits, bac_bits).Compress(fi, fo);
+            };
+        }
+        else if (algo == Algorithm::LZSS_BAC) {
+            return [bac, level](BitStream& fi, BitStream& fo) {
+                Pipeline(
+                    [level](BitStream& in, BitStream& out) { LZSS(level).Compress(in, out); },
+                    bac
+                ).Run(fi, fo);
+            };
+        }
+        return [bits](BitStream& fi, BitStream& fo) { LZW(bits).Compress(fi, fo); };
+    }
+
+    BlockCodec::Codec Decompressor() const {
+        int order = options.order;
+        int bac_bits = options.bac_bits;
+        auto bac = BacDecompressor();
+        if (algo == Algorithm::BAC) {
+            return bac;
+        }
+        else if (algo == Algorithm::RANGE) {
+            return [order](BitStream& fi, BitStream& fo) { RangeCoder(order).Decompress(fi, fo); };
+        }
+        else if (algo == Algorithm::LZW_BAC) {
+            return [bac](BitStream& fi, BitStream& fo) {
+                Pipeline(
+                    bac,
+                    [](BitStream& in, BitStream& out) { LZW().Decompress(in, out); }
+                ).Run(fi, fo);
+            };
+        }
+        else if (algo == Algorithm::RANS) {
+            return [](BitStream& fi, BitStream& fo) { RANS().Decompress(fi, fo); };
+        }
+        else if (algo == Algorithm::LZW_RANS) {
+            return [](BitStream& fi, BitStream& fo) {
+                Pipeline(
+                    [](BitStream& in, BitStream& out) { RANS().Decompress(in, out); },
+                    [](BitStream& in, BitStream& out) { LZW().Decompress(in, out); }
+                ).Run(fi, fo);
+            };
+        }
+        else if (algo == Algorithm::LZSS) {
+            return [](BitStream& fi, BitStream& fo) { LZSS().Decompress(fi, fo); };
+        }
+        else if (algo == Algorithm::AUTO) {
+            return [order, bac_bits](BitStream& fi, BitStream& fo) {
+                AutoCodec(order, LZW::DEFAULT_MAX_BITS, bac_bits).Decompress(fi, fo);
+            };
+        }
+        else if (algo == Algorithm::LZSS_BAC) {
+            return [bac](BitStream& fi, BitStream& fo) {
+                Pipeline(
+                    bac,
+                    [](BitStream& in, BitStream& out) { LZSS().Decompress(in, out); }
+                ).Run(fi, fo);
+            };
+        }
+        return [](BitStream& fi, BitStream& fo) { LZW().Decompress(fi, fo); };
+    }
+
+    // The standard input and anything else that can't be mapped is read
+    // ahead on its own thread, and the output is written behind on another,
+    // so reading, coding and writing overlap.
+    std::unique_ptr<ByteSource> OpenInput() const {
+        auto source = OpenSource(filename, BitStream::BUFFER_MAX_SIZE);
+        if (source->rewindable()) {
+            return source; // mapped
+        }
+        return std::make_unique<ReadAheadSource>(std::move(source));
+    }
+
+    std::unique_ptr<ByteSink> OpenOutput() const {
+        return std::make_unique<WriteBehindSink>(OpenSink(output_name));
+    }
+
+    void CompressFile() {
+        CRC32C crc;
+        uint64_t size = 0;
+        BitStream fi(std::make_unique<CrcSource>(OpenInput(), crc, size));
+        BitStream fo(OpenOutput());
+
+        ArchiveHeader header;
+        header.algorithm = static_cast<uint32_t>(algo);
+        header.flags = blocks ? ArchiveHeader::BLOCKS_FLAG : 0;
+        if (options.bac_bits == BAC32::CODE_BITS) {
+            header.flags |= ArchiveHeader::BAC32_FLAG;
+        }
+        header.order = options.order;
+        header.lzw_bits = options.lzw_bits;
+        header.write(fo);
+
+        if (blocks) {
+            BlockCodec(options.block_size, options.threads).Compress(fi, fo, Compressor());
+        } else {
+            Compressor()(fi, fo);
+        }
+        ArchiveTrailer{size, crc.value()}.write(fo);
+        fo.finish();
+        STATS_ADD(RAW_BYTES, size);
+    }
+
+    // The algorithm comes from the archive header. With -t the output goes
+    // to a NullSink; either way it is checked against the trailer.
+    void DecompressFile() {
+        auto source = std::make_unique<HoldBackSource>(OpenInput(), ArchiveTrailer::SIZE);
+        HoldBackSource& archive = *source;
+        BitStream fi(std::move(source));
+
+        ArchiveHeader header = ArchiveHeader::read(fi);
+        if (header.algorithm > static_cast<uint32_t>(Algorithm::AUTO)) {
+            throw IntegrityError{"unknown algorithm"};
+        }
+        algo = static_cast<Algorithm>(header.algorithm);
+        blocks = header.flags & ArchiveHeader::BLOCKS_FLAG;
+        options.order = header.order;
+        options.bac_bits = header.flags & ArchiveHeader::BAC32_FLAG ? BAC32::CODE_BITS : BAC::CODE_BITS;
+        if (IsStdin(filename) && (header.flags & ArchiveHeader::SOLID_FLAG || (options.range && blocks))) {
+            throw IntegrityError{"can't seek on the standard input"};
+        }
+        if (header.flags & ArchiveHeader::SOLID_FLAG) {
+            ExtractSolid();
+            return;
+        }
+        if (options.range && blocks) {
+            DecompressBlockRange();
+            return;
+        }
+
+        CRC32C crc;
+        uint64_t size = 0;
+        try {
+            std::unique_ptr<ByteSink> sink;
+            if (flag & TEST_INTEGRITY_BIT) {
+                sink = std::make_unique<NullSink>();
+            } else {
+                sink = OpenOutput();
             }
-            else if (algo == Algorithm::BAC) {
-                BAC bac;
-                bac.Compress(filename, output_name);
-            } 
-            else if (algo == Algorithm::LZW_BAC) {
-                LZW lzw;
-                BAC bac;
-                output_name += ".lzw";
-                lzw.Compress(filename, output_name);
-                bac.Compress(output_name, output_name + ".bac");
-                fs::path p = fs::current_path() / output_name;
-                output_name += ".bac";
-                fs::remove(p);
-            }
-        }
-        else if (mode == Mode::Decompress) {
-            if (algo == Algorithm::LZW) {
-                LZW lzw;
-                lzw.Decompress(filename, output_name);
-            }
-            else if (algo == Algorithm::BAC) {
-                BAC bac;
-                bac.Decompress(filename, output_name);
-            } 
-            else if (algo == Algorithm::LZW_BAC) {
-                LZW lzw;
-                BAC bac;
+            if (options.range) {
+                // no index without blocks: decode it all, keep the range
+                sink = std::make_unique<RangeSink>(std::move(sink), options.range_offset, options.range_length);
+            }
+            BitStream fo(std::make_unique<CrcSink>(std::move(sink), crc, size));
+            if (blocks) {
+                BlockCodec(options.block_size, options.threads).Decompress(fi, fo, Decompressor());
+            } else {
+                Decompressor()(fi, fo);
+            }
+            fo.finish();
 
-                bac.Decompress(filename, output_name + ".lzw");
-                lzw.Decompress(output_name + ".lzw", output_name);
-                
-                output_name += ".lzw";
-                fs::path p = fs::current_path() / output_name;
-                
-                fs::remove(p);
+            // decoders that stop at their own end marker may leave padding
+            fi.alignToByte();
+            unsigned char rest[256];
+            while (fi.readBytes(rest, sizeof(rest)) != 0) {
+            }
+        } catch (EOFReachedException& ex) {
+            throw IntegrityError{"unexpected end of archive"};
+        } catch (std::exception& ex) {
+            throw IntegrityError{ex.what()};
+        }
+
+        STATS_ADD(RAW_BYTES, size);
+        ArchiveTrailer trailer = ArchiveTrailer::read(archive.held());
+        if (trailer.size != size) {
+            throw IntegrityError{"size mismatch"};
+        }
+        if (trailer.crc != crc.value()) {
+            throw IntegrityError{"CRC mismatch"};
+        }
+    }
+
+    // -r --solid: the whole tree goes into one <dir>.solid, in groups of
+    // block_size bytes coded in parallel. --dedup stores repeated chunks of
+    // the files once.
+    bool CompressSolid(std::vector<std::string> files) {
+        std::sort(files.begin(), files.end());
+        SetOutputName();
+        auto create = [this, &files]() {
+            BitStream fo(output_name, "w");
+            ArchiveHeader header;
+            header.algorithm = static_cast<uint32_t>(algo);
+            header.flags = ArchiveHeader::SOLID_FLAG;
+            if (flag & DEDUP_BIT) {
+                header.flags |= ArchiveHeader::DEDUP_FLAG;
+            }
+            if (options.bac_bits == BAC32::CODE_BITS) {
+                header.flags |= ArchiveHeader::BAC32_FLAG;
+            }
+            header.order = options.order;
+            header.lzw_bits = options.lzw_bits;
+            SolidArchive::Create(fo, header, filename, files, Compressor(),
+                                 options.block_size, options.threads);
+            fo.finish();
+        };
+
+        // the files are removed only once the archive is known to be complete
+        try {
+            if (flag & LIST_INFO_BIT) {
+                TimerGuard t("\nProcessing " + filename + "(sec):", out);
+                create();
+            } else {
+                create();
+            }
+        } catch (std::runtime_error& err) {
+            out << filename << ": " << err.what() << '\n';
+            std::error_code ec;
+            fs::remove(output_name, ec);
+            return false;
+        }
+
+        if (flag & LIST_INFO_BIT) {
+            out.setf(std::ios::fixed);
+            long double s1 = 0;
+            for (const std::string& f : files) {
+                s1 += fs::file_size(f);
+            }
+            out << std::setprecision(0) << "Size of files in \'" << filename << "\'(bytes): " << s1 << '\n';
+            long double s2 = fs::file_size(output_name);
+            out << std::setprecision(0) << "After compressing(bytes): " << s2 << '\n';
+            out << "Compression ratio: " << std::setprecision(3) << s1 / s2 << "\n\n";
+        }
+
+        if (!(flag & KEEP_ORIGIN_BIT)) {
+            for (const std::string& f : files) {
+                fs::remove(f);
+            }
+        }
+        return true;
+    }
+
+    // Members go under <archive>.res/, to stdout with -c or nowhere with -t.
+    // --extract decodes only the groups holding the named member.
+    void ExtractSolid() {
+        try {
+            SolidArchive archive(filename);
+            const auto& members = archive.Members();
+            size_t first = 0;
+            size_t last = members.size();
+            if (!options.extract.empty()) {
+                auto it = std::find_if(members.begin(), members.end(), [this](const auto& m) {
+                    return m.name == options.extract;
+                });
+                if (it == members.end()) {
+                    throw IntegrityError{options.extract + ": no such member"};
+                }
+                first = it - members.begin();
+                last = first + 1;
+            }
+
+            fs::path root(output_name);
+            auto open = [this, &root](const SolidArchive::Member& m) -> std::unique_ptr<ByteSink> {
+                if (flag & TEST_INTEGRITY_BIT) {
+                    return std::make_unique<NullSink>();
+                }
+                if (flag & STD_OUTPUT_BIT) {
+                    return OpenSink("stdout");
+                }
+                fs::path p = root / m.name;
+                fs::create_directories(p.parent_path());
+                return OpenSink(p.string());
+            };
+            auto done = [this, &root](const SolidArchive::Member& m) {
+                if (flag & (TEST_INTEGRITY_BIT | STD_OUTPUT_BIT)) {
+                    return;
+                }
+                fs::path p = root / m.name;
+                fs::last_write_time(p, fs::file_time_type(fs::file_time_type::duration(m.mtime)));
+                fs::permissions(p, static_cast<fs::perms>(m.mode));
+            };
+            archive.Extract(first, last, Decompressor(), options.threads, open, done);
+        } catch (EOFReachedException& ex) {
+            throw IntegrityError{"unexpected end of archive"};
+        } catch (std::exception& ex) {
+            throw IntegrityError{ex.what()};
+        }
+    }
+
+    // --members: the directory of a solid archive, without decoding anything
+    bool ListMembers() {
+        try {
+            SolidArchive archive(filename);
+            for (const auto& m : archive.Members()) {
+                out << std::setw(12) << m.size << ' ' << m.name << '\n';
             }
+        } catch (IntegrityError& err) {
+            out << filename << ": " << err.reason << '\n';
+            return false;
         }
+        return true;
     }
+
+    // --range on a block archive: the block index leads straight to the
+    // blocks holding the range, so the cost follows the range, not the
+    // file. The trailer CRC covers the whole file and isn't checked.
+    void DecompressBlockRange() {
+        try {
+            std::ifstream in(filename, std::ios::in | std::ios::binary);
+            uint64_t end = fs::file_size(filename);
+            if (end < ArchiveHeader::SIZE + ArchiveTrailer::SIZE) {
+                throw IntegrityError{"truncated archive"};
+            }
+            std::unique_ptr<ByteSink> sink;
+            if (flag & TEST_INTEGRITY_BIT) {
+                sink = std::make_unique<NullSink>();
+            } else {
+                sink = OpenSink(output_name);
+            }
+            BitStream fo(std::move(sink));
+            BlockCodec(options.block_size, options.threads).DecompressRange(
+                in, ArchiveHeader::SIZE, end - ArchiveTrailer::SIZE,
+                options.range_offset, options.range_length, fo, Decompressor());
+            fo.finish();
+        } catch (EOFReachedException& ex) {
+            throw IntegrityError{"unexpected end of archive"};
+        } catch (std::exception& ex) {
+            throw IntegrityError{ex.what()};
+        }
+    }
+
+    void ProcessFile() {
+        STATS_PHASE(CODE);
+        if (mode == Mode::Compress) {
+            CompressFile();
+        } else {
+            DecompressFile();
+        }
+    }
+
     void Archive() {
         if (flag & LIST_INFO_BIT) {
             {
-                TimerGuard t("\nProcessing " + filename + "(sec):");
+                TimerGuard t("\nProcessing " + filename + "(sec):", out);
                 ProcessFile();    
             }
-            if (mode == Mode::Compress) {
-                std::cout.setf(std::ios::fixed);
+            // sizes are reported only between files: a pipe has none, and
+            // the report would land in the data on stdout
+            if (mode == Mode::Compress && !IsStdin(filename) && !(flag & STD_OUTPUT_BIT)) {
+                out.setf(std::ios::fixed);
                 fs::path p = fs::current_path() / filename;
                 long double s1 = fs::file_size(p);
-                std::cout << std::setprecision(0) << "Size of file \'" << filename << "\'(bytes): " << s1 << '\n';
+                out << std::setprecision(0) << "Size of file \'" << filename << "\'(bytes): " << s1 << '\n';
 
                 fs::path p2 = fs::current_path() / output_name;
                 long double s2 = fs::file_size(p2);
-                std::cout << std::setprecision(0) << "After compressing(bytes): " << s2 << '\n';
+                out << std::setprecision(0) << "After compressing(bytes): " << s2 << '\n';
                 
-                std::cout << "Compression ratio: " << std::setprecision(3) << s1 / s2 << "\n\n";
+                out << "Compression ratio: " << std::setprecision(3) << s1 / s2 << "\n\n";
             }
 
         }
@@ -150,13 +572,126 @@ private:
         }
     }
 
+    // Returns false if the file failed to decode or verify.
+    bool ProcessOne() {
+        STATS_FILE(filename);
+        SetOutputName();
+        auto fail = [this](const std::string& reason) {
+            out << filename << ": " << reason << '\n';
+            if (!(flag & (TEST_INTEGRITY_BIT | STD_OUTPUT_BIT))) {
+                // a partly extracted solid archive is a non-empty directory
+                std::error_code ec;
+                fs::remove(output_name, ec);
+            }
+            return false;
+        };
+        try {
+            Archive();
+        } catch (IntegrityError& err) {
+            return fail(err.reason);
+        } catch (std::runtime_error& err) {
+            // the output couldn't be written; the input stays
+            return fail(err.what());
+        }
+        if (flag & TEST_INTEGRITY_BIT) {
+            out << filename << ": OK\n";
+            return true;
+        }
+        // --extract and --range take a part out and leave the archive alone
+        if (!(flag & KEEP_ORIGIN_BIT) && options.extract.empty() && !options.range) {
+            fs::remove(filename);
+        }
+        return true;
+    }
+
+    // Files go to a work-stealing pool largest first, so the long jobs start
+    // early and the small ones fill in around them. Each file's report is
+    // buffered and printed in directory order once it is done.
+    bool ProcessParallel(const std::vector<std::string>& files) {
+        std::vector<size_t> order(files.size());
+        std::vector<uintmax_t> sizes(files.size());
+        for (size_t i = 0; i < files.size(); ++i) {
+            order[i] = i;
+            std::error_code ec;
+            sizes[i] = fs::file_size(files[i], ec);
+        }
+        std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) {
+            return sizes[a] > sizes[b];
+        });
+
+        // the files themselves are the unit of parallelism
+        ArchiverOptions file_options = options;
+        file_options.threads = 1;
+
+        WorkStealingPool pool(options.threads);
+        std::vector<std::future<std::string>> reports(files.size());
+        std::vector<char> ok(files.size());
+        for (size_t i : order) {
+            reports[i] = pool.submit([this, file_options, curfile = files[i], &ok, i]() {
+                std::ostringstream report;
+                ArchiverData a(flag, curfile, file_options, report);
+                ok[i] = a.ProcessOne();
+                return report.str();
+            });
+        }
+        for (auto& report : reports) {
+            out << report.get();
+        }
+        return std::find(ok.begin(), ok.end(), false) == ok.end();
+    }
+
 public:
-    ArchiverData(int flag, std::string filename) 
-    : flag(flag), filename(filename) {
+    ArchiverData(int flag, std::string filename, ArchiverOptions options = ArchiverOptions(),
+                 std::ostream& out = std::cout)
+    : flag(flag), options(options), out(out), filename(filename) {
         EstablishOptions();
     }
 
-    void Process() {
+    // Runs every algorithm over the synthetic corpus, or over `files` when
+    // given, and writes the results as JSON.
+    static bool Bench(const std::vector<std::string>& files, ArchiverOptions options,
+                      std::ostream& json) {
+        Benchmark bench;
+        if (files.empty()) {
+            bench.AddSyntheticCorpus();
+        }
+        for (const std::string& f : files) {
+            bench.AddFile(f);
+        }
+
+        const std::tuple<const char*, int, int> algorithms[] = {
+            {"lzw", 0, BAC::LEGACY_ORDER},
+            {"bac", USE_BAC_BIT, BAC::LEGACY_ORDER},
+            {"bac-o1", USE_BAC_BIT, 1},
+            {"bac-o2", USE_BAC_BIT, 2},
+            {"bac-static", USE_BAC_BIT, BAC::STATIC_ORDER},
+            {"lzw+bac", USE_LZW_AND_BAC_BIT, BAC::LEGACY_ORDER},
+            {"range", USE_RANGE_BIT, BAC::LEGACY_ORDER},
+            {"range-o2", USE_RANGE_BIT, 2},
+            {"range-static", USE_RANGE_BIT, BAC::STATIC_ORDER},
+            {"rans", USE_RANS_BIT, BAC::LEGACY_ORDER},
+            {"lzw+rans", USE_LZW_AND_BAC_BIT | USE_RANS_BIT, BAC::LEGACY_ORDER},
+            {"lzss", USE_LZSS_BIT, BAC::LEGACY_ORDER},
+            {"lzss+bac", USE_LZW_AND_BAC_BIT | USE_LZSS_BIT, BAC::LEGACY_ORDER},
+            {"auto", USE_AUTO_BIT, BAC::LEGACY_ORDER},
+        };
+        for (auto& [name, algo_flag, order] : algorithms) {
+            options.order = order;
+            ArchiverData a(algo_flag, "", options);
+            bench.AddCodec(name, a.Compressor(), a.Decompressor());
+        }
+        options.order = BAC::LEGACY_ORDER;
+        options.bac_bits = BAC32::CODE_BITS;
+        ArchiverData bac32(USE_BAC_BIT, "", options);
+        bench.AddCodec("bac32", bac32.Compressor(), bac32.Decompressor());
+        return bench.Run(json);
+    }
+
+    // Returns false if any file failed.
+    bool Process() {
+        if (flag & LIST_MEMBERS_BIT) {
+            return ListMembers();
+        }
         if (flag & RECURSIVE_BIT && fs::is_directory(filename)) {
             std::vector<std::string> files;
             
@@ -166,27 +701,44 @@ public:
                     files.push_back(std::string(p.c_str()));
                 }
             }
+            if (flag & SOLID_BIT && mode == Mode::Compress) {
+                return CompressSolid(files);
+            }
 
-            for (std::string curfile : files) {
-                filename = curfile;
-                SetOutputName();
-                Archive();
-                if (!(flag & KEEP_ORIGIN_BIT)) {
-                    fs::remove(filename);
+            // with -c every file goes to the same stdout, in order
+            if (flag & STD_OUTPUT_BIT || options.threads == 1) {
+                bool ok = true;
+                for (std::string curfile : files) {
+                    filename = curfile;
+                    ok = ProcessOne() && ok;
                 }
+                return ok;
             }
-        } else {
-            SetOutputName();
-            Archive();
-            if (!(flag & KEEP_ORIGIN_BIT)) {
-                fs::remove(filename);
-            }
+            return ProcessParallel(files);
         }
+        return ProcessOne();
     }
 };
 
 
 
+// "64K", "16M", "1G" or a plain byte count
+size_t ParseSize(const std::string& s) {
+    size_t idx = 0;
+    size_t res = std::stoull(s, &idx);
+    std::string suffix = s.substr(idx);
+    if (suffix == "K" || suffix == "k") {
+        res <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        res <<= 20;
+    } else if (suffix == "G" || suffix == "g") {
+        res <<= 30;
+    } else if (!suffix.empty()) {
+        throw std::invalid_argument("bad size suffix");
+    }
+    return res;
+}
+
 int main(int argc, char const *argv[])
 {
     if (argc <= 1) {
@@ -195,7 +747,10 @@ int main(int argc, char const *argv[])
     }
 
     int flag = 0;
-    int file_arg_idx = 0;
+    int file_arg_idx = argc;
+    bool bench = false;
+    std::string stats_format;
+    ArchiverOptions options;
 
     for (int i = 1; i < argc; ++i) {
         std::string curArg(argv[i]);
@@ -228,13 +783,28 @@ int main(int argc, char const *argv[])
                     case '9':
                         flag |= USE_LZW_AND_BAC_BIT;
                         break;
+                    case '2':
+                        flag |= USE_RANGE_BIT;
+                        break;
+                    case '3':
+                        flag |= USE_RANS_BIT;
+                        break;
+                    case '4':
+                        flag |= USE_LZSS_BIT;
+                        break;
+                    case 'a':
+                        flag |= USE_AUTO_BIT;
+                        break;
+                    case 'b':
+                        flag |= BLOCK_MODE_BIT;
+                        break;
                     default:
-                        std::cout << "Invalid flag: " << flags[i] << '\n';
+                        std::cout << "Invalid flag: " << flags[j] << '\n';
                         return 1;
                 }
             }
             file_arg_idx = i+1;
-            break;
+            continue;
         }
         else if (curArg == "-c" || curArg == "--stdout") {
             flag |= STD_OUTPUT_BIT;
@@ -260,22 +830,184 @@ int main(int argc, char const *argv[])
         else if (curArg == "-9" || curArg == "--all") {
             flag |= USE_LZW_AND_BAC_BIT;
         }
+        else if (curArg == "-2" || curArg == "--range") {
+            flag |= USE_RANGE_BIT;
+        }
+        else if (curArg == "-3" || curArg == "--rans") {
+            flag |= USE_RANS_BIT;
+        }
+        else if (curArg == "-4" || curArg == "--lzss") {
+            flag |= USE_LZSS_BIT;
+        }
+        else if (curArg.rfind("--level=", 0) == 0) {
+            try {
+                options.level = std::stoi(curArg.substr(curArg.find('=') + 1));
+            } catch (std::exception& ex) {
+                options.level = 0;
+            }
+            if (options.level < LZSS::MIN_LEVEL || options.level > LZSS::MAX_LEVEL) {
+                std::cout << "Invalid LZSS level: " << curArg << '\n';
+                return 1;
+            }
+        }
+        else if (curArg == "-a" || curArg == "--auto") {
+            flag |= USE_AUTO_BIT;
+        }
+        else if (curArg == "--bench") {
+            bench = true;
+        }
+        else if (curArg == "-b" || curArg == "--blocks") {
+            flag |= BLOCK_MODE_BIT;
+        }
+        else if (curArg.rfind("--block-size=", 0) == 0) {
+            flag |= BLOCK_MODE_BIT;
+            try {
+                options.block_size = ParseSize(curArg.substr(curArg.find('=') + 1));
+            } catch (std::exception& ex) {
+                std::cout << "Invalid block size: " << curArg << '\n';
+                return 1;
+            }
+            if (options.block_size == 0 || options.block_size > BlockCodec::MAX_BLOCK_SIZE) {
+                std::cout << "Invalid block size: " << curArg << '\n';
+                return 1;
+            }
+        }
+        else if (curArg.rfind("--order=", 0) == 0) {
+            try {
+                options.order = std::stoi(curArg.substr(curArg.find('=') + 1));
+            } catch (std::exception& ex) {
+                options.order = -1;
+            }
+            if (options.order < 0 || options.order > ContextModel::MAX_ORDER) {
+                std::cout << "Invalid model order: " << curArg << '\n';
+                return 1;
+            }
+        }
+        else if (curArg.rfind("--lzw-bits=", 0) == 0) {
+            try {
+                options.lzw_bits = std::stoi(curArg.substr(curArg.find('=') + 1));
+            } catch (std::exception& ex) {
+                options.lzw_bits = 0;
+            }
+            if (options.lzw_bits < LZW::MIN_BITS || options.lzw_bits > LZW::MAX_BITS) {
+                std::cout << "Invalid LZW code width: " << curArg << '\n';
+                return 1;
+            }
+        }
+        else if (curArg.rfind("--bac-bits=", 0) == 0) {
+            try {
+                options.bac_bits = std::stoi(curArg.substr(curArg.find('=') + 1));
+            } catch (std::exception& ex) {
+                options.bac_bits = 0;
+            }
+            if (options.bac_bits != BAC::CODE_BITS && options.bac_bits != BAC32::CODE_BITS) {
+                std::cout << "Invalid BAC precision: " << curArg << '\n';
+                return 1;
+            }
+        }
+        else if (curArg == "--solid") {
+            flag |= SOLID_BIT | RECURSIVE_BIT;
+        }
+        else if (curArg == "--dedup") {
+            flag |= DEDUP_BIT | SOLID_BIT | RECURSIVE_BIT;
+        }
+        else if (curArg == "--members") {
+            flag |= LIST_MEMBERS_BIT;
+        }
+        else if (curArg.rfind("--extract=", 0) == 0) {
+            flag |= DECOMPRESS_BIT;
+            options.extract = curArg.substr(curArg.find('=') + 1);
+        }
+        else if (curArg.rfind("--range=", 0) == 0) {
+            // OFFSET:LEN, both with the size suffixes of --block-size
+            flag |= DECOMPRESS_BIT;
+            std::string spec = curArg.substr(curArg.find('=') + 1);
+            size_t colon = spec.find(':');
+            try {
+                if (colon == std::string::npos) {
+                    throw std::invalid_argument("no length");
+                }
+                options.range_offset = ParseSize(spec.substr(0, colon));
+                options.range_length = ParseSize(spec.substr(colon + 1));
+            } catch (std::exception& ex) {
+                std::cout << "Invalid range: " << curArg << '\n';
+                return 1;
+            }
+            options.range = true;
+        }
+        else if (curArg.rfind("--stats=", 0) == 0) {
+            stats_format = curArg.substr(curArg.find('=') + 1);
+            if (stats_format != "json" && stats_format != "csv" && stats_format != "trace") {
+                std::cout << "Invalid stats format: " << curArg << '\n';
+                return 1;
+            }
+#ifdef ARCHIVER_STATS
+            if (stats_format == "trace") {
+                Stats::EnableTracing();
+            }
+#else
+            std::cout << "Built without ARCHIVER_STATS, no counters to report\n";
+            return 1;
+#endif
+        }
+        else if (curArg == "--static") {
+            options.order = BAC::STATIC_ORDER;
+        }
+        else if (curArg.rfind("--threads=", 0) == 0) {
+            try {
+                options.threads = std::stoul(curArg.substr(curArg.find('=') + 1));
+            } catch (std::exception& ex) {
+                std::cout << "Invalid thread count: " << curArg << '\n';
+                return 1;
+            }
+        }
         else {
             file_arg_idx = i;
             break;
         }
     }
 
+    if (bench) {
+        std::vector<std::string> files;
+        for (int i = file_arg_idx; i < argc; ++i) {
+            if (!fs::exists(argv[i])) {
+                std::cout << "File " << argv[i] << " was not found\n";
+                return 1;
+            }
+            files.push_back(argv[i]);
+        }
+        return ArchiverData::Bench(files, options, std::cout) ? 0 : 1;
+    }
+
+    int status = 0;
     for (int i = file_arg_idx; i < argc; ++i) {
         std::string filename(argv[i]);
-        if (fs::exists(filename)) {
-            ArchiverData a(flag, filename);
-            a.Process();
+        if (IsStdin(filename)) {
+            // like gzip: from a pipe to a pipe
+            ArchiverData a(flag | STD_OUTPUT_BIT | KEEP_ORIGIN_BIT, filename, options);
+            if (!a.Process()) {
+                status = 1;
+            }
+        } else if (fs::exists(filename)) {
+            ArchiverData a(flag, filename, options);
+            if (!a.Process()) {
+                status = 1;
+            }
         } else {
             std::cout << "File " << filename << " was not found\n";
             return 1;
         }
     }
 
-    return 0;
+#ifdef ARCHIVER_STATS
+    // stderr, as stdout may be carrying the data
+    if (stats_format == "json") {
+        Stats::ExportJson(std::cerr);
+    } else if (stats_format == "csv") {
+        Stats::ExportCsv(std::cerr);
+    } else if (stats_format == "trace") {
+        Stats::ExportTrace(std::cerr);
+    }
+#endif
+    return status;
 }
@@ -0,0 +1,102 @@
+# Round trips files through the console executable: every algorithm, block
+# mode, a byte range and a solid archive with and without deduplication,
+# each checked with -t too.
+# Run by ctest as
+#
+#   cmake -DCONSOLE=<console> -DSOURCE_DIR=<repo> -DWORK_DIR=<scratch> -P console_test.cmake
+#
+# Everything runs inside WORK_DIR on relative names, as the console derives
+# output names from the first dot of a path.
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR}/tree/sub)
+
+string(REPEAT "the archive codec block of stream bits\n" 3000 text)
+file(WRITE ${WORK_DIR}/tree/text "${text}")
+file(WRITE ${WORK_DIR}/tree/empty "")
+file(WRITE ${WORK_DIR}/tree/sub/single "x")
+file(COPY ${SOURCE_DIR}/kp4.pdf DESTINATION ${WORK_DIR}/tree/sub)
+
+function(run)
+    execute_process(COMMAND ${CONSOLE} ${ARGN}
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE status
+        OUTPUT_VARIABLE output
+        ERROR_VARIABLE output)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "console ${ARGN} failed (${status}):\n${output}")
+    endif()
+endfunction()
+
+function(run_to file)
+    execute_process(COMMAND ${CONSOLE} ${ARGN}
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE status
+        OUTPUT_FILE ${WORK_DIR}/${file}
+        ERROR_VARIABLE output)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "console ${ARGN} failed (${status}):\n${output}")
+    endif()
+endfunction()
+
+function(expect_same expected actual what)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${expected} ${actual}
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE status)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "${what}: ${actual} differs from ${expected}")
+    endif()
+endfunction()
+
+set(modes
+    "-ck" "-ck1" "-ck9" "-ck2" "-ck3" "-ck93" "-ck4" "-ck94" "-cka"
+    "-ck1 --order=2" "-ck1 --static" "-ck1 --bac-bits=32" "-ck4 --level=9"
+    "-ckb --block-size=16k" "-ck9b --block-size=16k")
+foreach(mode IN LISTS modes)
+    separate_arguments(args UNIX_COMMAND "${mode}")
+    foreach(input tree/text tree/empty tree/sub/single tree/sub/kp4.pdf)
+        run_to(packed ${args} ${input})
+        run(-tk packed)
+        run_to(unpacked -cdk packed)
+        expect_same(${input} unpacked "${mode}")
+    endforeach()
+endforeach()
+
+# a byte range, through the block index
+run_to(packed -ckb --block-size=16k tree/text)
+run_to(range -cdk --range=20000:50000 packed)
+string(SUBSTRING "${text}" 20000 50000 expected)
+file(WRITE ${WORK_DIR}/expected "${expected}")
+expect_same(expected range "--range")
+
+# a solid archive of the whole tree, extracted into tree.res
+run(-k --solid tree)
+run(-tk tree.solid)
+run(-dk tree.solid)
+file(GLOB_RECURSE members RELATIVE ${WORK_DIR}/tree ${WORK_DIR}/tree/*)
+foreach(member IN LISTS members)
+    expect_same(tree/${member} tree.res/${member} "--solid")
+endforeach()
+
+# --dedup over a tree holding a copy and an edited copy: everything comes
+# back, and the repeats are stored once
+file(MAKE_DIRECTORY ${WORK_DIR}/tree/copy)
+file(COPY ${SOURCE_DIR}/kp4.pdf DESTINATION ${WORK_DIR}/tree/copy)
+string(REPLACE "codec block" "codec edited block" edited "${text}")
+file(WRITE ${WORK_DIR}/tree/copy/text "${edited}")
+run(-k --solid tree)
+file(SIZE ${WORK_DIR}/tree.solid solid_size)
+file(REMOVE_RECURSE ${WORK_DIR}/tree.res)
+run(-k --dedup tree)
+file(SIZE ${WORK_DIR}/tree.solid dedup_size)
+if(NOT dedup_size LESS solid_size)
+    message(FATAL_ERROR "--dedup: ${dedup_size} bytes, not less than --solid's ${solid_size}")
+endif()
+run(-tk tree.solid)
+run(-dk tree.solid)
+file(GLOB_RECURSE members RELATIVE ${WORK_DIR}/tree ${WORK_DIR}/tree/*)
+foreach(member IN LISTS members)
+    expect_same(tree/${member} tree.res/${member} "--dedup")
+endforeach()
+run(-k --extract=copy/kp4.pdf tree.solid)
+expect_same(tree/copy/kp4.pdf tree.res/copy/kp4.pdf "--dedup --extract")
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "byte_io.hpp"
+
+#include "cstdint"
+#include "cstring"
+#include "memory"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ARCHIVER_HAVE_SSE42_CRC 1
+#endif
+
+
+// CRC-32C (Castagnoli), as used by iSCSI and ext4. Uses the SSE4.2 crc32
+// instruction when the CPU has it and slice-by-8 tables otherwise.
+class CRC32C {
+private:
+    static constexpr uint32_t POLYNOMIAL = 0x82F63B78; // reflected
+
+    uint32_t state = 0xFFFFFFFF;
+
+    struct Tables {
+        uint32_t t[8][256];
+
+        Tables() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c >> 1) ^ (POLYNOMIAL & (0 - (c & 1)));
+                }
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int k = 1; k < 8; ++k) {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    static const Tables& tables() {
+        static const Tables instance;
+        return instance;
+    }
+
+    // Eight bytes per step through eight tables; assumes little endian.
+    static uint32_t updateSoftware(uint32_t crc, const unsigned char* p, size_t n) {
+        const Tables& tab = tables();
+        while (n >= 8) {
+            uint32_t lo;
+            uint32_t hi;
+            std::memcpy(&lo, p, 4);
+            std::memcpy(&hi, p + 4, 4);
+            lo ^= crc;
+            crc = tab.t[7][lo & 0xFF] ^ tab.t[6][(lo >> 8) & 0xFF]
+                ^ tab.t[5][(lo >> 16) & 0xFF] ^ tab.t[4][lo >> 24]
+                ^ tab.t[3][hi & 0xFF] ^ tab.t[2][(hi >> 8) & 0xFF]
+                ^ tab.t[1][(hi >> 16) & 0xFF] ^ tab.t[0][hi >> 24];
+            p += 8;
+            n -= 8;
+        }
+        while (n-- > 0) {
+            crc = (crc >> 8) ^ tab.t[0][(crc ^ *p++) & 0xFF];
+        }
+        return crc;
+    }
+
+#ifdef ARCHIVER_HAVE_SSE42_CRC
+    __attribute__((target("sse4.2")))
+    static uint32_t updateHardware(uint32_t crc, const unsigned char* p, size_t n) {
+#ifdef __x86_64__
+        uint64_t c = crc;
+        while (n >= 8) {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+            c = __builtin_ia32_crc32di(c, v);
+            p += 8;
+            n -= 8;
+        }
+        crc = static_cast<uint32_t>(c);
+#endif
+        while (n-- > 0) {
+            crc = __builtin_ia32_crc32qi(crc, *p++);
+        }
+        return crc;
+    }
+
+    static bool hasHardware() {
+        static const bool has = __builtin_cpu_supports("sse4.2");
+        return has;
+    }
+#endif
+
+public:
+    void update(const unsigned char* data, size_t size) {
+#ifdef ARCHIVER_HAVE_SSE42_CRC
+        if (hasHardware()) {
+            state = updateHardware(state, data, size);
+            return;
+        }
+#endif
+        state = updateSoftware(state, data, size);
+    }
+
+    uint32_t value() const {
+        return ~state;
+    }
+
+    void reset() {
+        state = 0xFFFFFFFF;
+    }
+};
+
+// Checksums the chunks of a source as they are handed out. The CRC and
+// byte count live with the caller, so they outlive the BitStream that
+// owns the source.
+class CrcSource : public ByteSource {
+private:
+    std::unique_ptr<ByteSource> source;
+    CRC32C& crc;
+    uint64_t& size;
+
+public:
+    CrcSource(std::unique_ptr<ByteSource> source, CRC32C& crc, uint64_t& size)
+    : source(std::move(source)), crc(crc), size(size) {}
+
+    bool next(const unsigned char*& data, size_t& chunk_size) override {
+        if (!source->next(data, chunk_size)) {
+            return false;
+        }
+        crc.update(data, chunk_size);
+        size += chunk_size;
+        return true;
+    }
+
+    bool rewindable() const override {
+        return source->rewindable();
+    }
+
+    // a two-pass codec reads everything again: count it once
+    void rewind() override {
+        source->rewind();
+        crc.reset();
+        size = 0;
+    }
+};
+
+// Checksums everything written through it.
+class CrcSink : public ByteSink {
+private:
+    std::unique_ptr<ByteSink> sink;
+    CRC32C& crc;
+    uint64_t& size;
+
+public:
+    CrcSink(std::unique_ptr<ByteSink> sink, CRC32C& crc, uint64_t& size)
+    : sink(std::move(sink)), crc(crc), size(size) {}
+
+    void write(const unsigned char* data, size_t chunk_size) override {
+        crc.update(data, chunk_size);
+        size += chunk_size;
+        sink->write(data, chunk_size);
+    }
+
+    bool good() const override {
+        return sink->good();
+    }
+
+    void close() override {
+        sink->close();
+    }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "algorithm"
+#include "array"
+#include "cstddef"
+#include "cstdint"
+#include "cstring"
+
+
+// Content-defined chunking after FastCDC: a cut goes where a Gear rolling
+// hash of the last 64 bytes has its top bits clear, so an insert or delete
+// moves only the boundaries next to it and the rest of a near-duplicate
+// file splits into the same chunks. Cuts before AVG_SIZE need more zero
+// bits than cuts after it, which keeps the sizes close to the average.
+class Chunker {
+public:
+    static constexpr size_t MIN_SIZE = 2 << 10;
+    static constexpr size_t AVG_SIZE = 8 << 10;
+    static constexpr size_t MAX_SIZE = 64 << 10;
+
+private:
+    static constexpr uint64_t MASK_SMALL = ~uint64_t(0) << (64 - 15);
+    static constexpr uint64_t MASK_LARGE = ~uint64_t(0) << (64 - 11);
+
+    // a fixed splitmix64 sequence, so chunk boundaries, and with them the
+    // archives, are reproducible
+    static constexpr std::array<uint64_t, 256> gearTable() {
+        std::array<uint64_t, 256> table{};
+        uint64_t x = 0x9E3779B97F4A7C15;
+        for (uint64_t& v : table) {
+            x += 0x9E3779B97F4A7C15;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            v = z ^ (z >> 31);
+        }
+        return table;
+    }
+
+public:
+    // Length of the chunk starting at data. size bytes are available, which
+    // may be fewer than MAX_SIZE only at the end of the input.
+    static size_t Cut(const unsigned char* data, size_t size) {
+        if (size <= MIN_SIZE) {
+            return size;
+        }
+        static constexpr std::array<uint64_t, 256> GEAR = gearTable();
+        size_t limit = std::min(size, MAX_SIZE);
+        size_t normal = std::min(limit, AVG_SIZE);
+        uint64_t hash = 0;
+        size_t i = MIN_SIZE;
+        for (; i < normal; ++i) {
+            hash = (hash << 1) + GEAR[data[i]];
+            if (!(hash & MASK_SMALL)) {
+                return i + 1;
+            }
+        }
+        for (; i < limit; ++i) {
+            hash = (hash << 1) + GEAR[data[i]];
+            if (!(hash & MASK_LARGE)) {
+                return i + 1;
+            }
+        }
+        return limit;
+    }
+};
+
+// SHA-256 of a chunk. Chunks with equal fingerprints are taken to be equal
+// without comparing their bytes, as the first copy is already coded and
+// written when a repeat turns up; a cryptographic hash makes an accidental
+// or crafted collision infeasible, where a fast non-cryptographic one
+// could be attacked by a file in the tree.
+struct Fingerprint {
+    std::array<unsigned char, 32> digest{};
+
+    bool operator==(const Fingerprint& other) const {
+        return digest == other.digest;
+    }
+
+    bool operator<(const Fingerprint& other) const {
+        return digest < other.digest;
+    }
+
+    struct Hash {
+        size_t operator()(const Fingerprint& f) const {
+            size_t h;
+            std::memcpy(&h, f.digest.data(), sizeof(h));
+            return h;
+        }
+    };
+
+    static Fingerprint Of(const unsigned char* data, size_t size) {
+        uint32_t state[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                             0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+        size_t blocks = size / 64;
+        for (size_t i = 0; i < blocks; ++i) {
+            compress(state, data + i * 64);
+        }
+
+        // the tail, 0x80, zeros and the length in bits, in one or two blocks
+        unsigned char last[128] = {};
+        size_t rest = size % 64;
+        std::memcpy(last, data + blocks * 64, rest);
+        last[rest] = 0x80;
+        size_t tail = rest + 9 <= 64 ? 64 : 128;
+        uint64_t bits = uint64_t(size) * 8;
+        for (int b = 0; b < 8; ++b) {
+            last[tail - 1 - b] = static_cast<unsigned char>(bits >> (8 * b));
+        }
+        for (size_t at = 0; at < tail; at += 64) {
+            compress(state, last + at);
+        }
+
+        Fingerprint f;
+        for (int w = 0; w < 8; ++w) {
+            for (int b = 0; b < 4; ++b) {
+                f.digest[4 * w + b] = static_cast<unsigned char>(state[w] >> (24 - 8 * b));
+            }
+        }
+        return f;
+    }
+
+private:
+    static constexpr uint32_t K[64] = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+    static uint32_t rotr(uint32_t x, int r) {
+        return (x >> r) | (x << (32 - r));
+    }
+
+    static void compress(uint32_t state[8], const unsigned char* block) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16
+                 | uint32_t(block[4 * i + 2]) << 8 | uint32_t(block[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+};
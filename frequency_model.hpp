@@ -0,0 +1,241 @@
+#pragma once
+
+#include "stats.hpp"
+
+#include "cstdint"
+#include "stdexcept"
+#include "vector"
+#include "algorithm"
+
+
+struct Probability {
+    uint32_t low;
+    uint32_t high;
+    uint32_t count;
+};
+
+// Frequencies of the 256 byte values plus EOF (256) with their cumulative
+// sums kept in a Fenwick tree, so updating a symbol and finding the symbol
+// of a scaled value both take O(log n) instead of a walk over 257 entries.
+template <class Count>
+struct FenwickTable {
+    static constexpr int SYMBOLS = 257;
+    static constexpr int TOP_STEP = 256; // largest power of two <= SYMBOLS
+
+    Count tree[SYMBOLS + 1]; // 1-based, tree[i] covers freq(i - lowbit(i), i]
+    Count freq[SYMBOLS];
+    uint32_t total;
+
+    // Rebuilds the tree from freq in O(n).
+    void build() {
+        total = 0;
+        for (int i = 1; i <= SYMBOLS; ++i) {
+            tree[i] = 0;
+        }
+        for (int i = 1; i <= SYMBOLS; ++i) {
+            tree[i] += freq[i - 1];
+            total += freq[i - 1];
+            int parent = i + (i & -i);
+            if (parent <= SYMBOLS) {
+                tree[parent] += tree[i];
+            }
+        }
+    }
+
+    void init() {
+        for (int i = 0; i < SYMBOLS; ++i) {
+            freq[i] = 1;
+        }
+        build();
+    }
+
+    // sum of the frequencies of symbols below c
+    uint32_t cumulative(int c) const {
+        uint32_t res = 0;
+        for (int i = c; i > 0; i &= i - 1) {
+            res += tree[i];
+        }
+        return res;
+    }
+
+    void add(int c, uint32_t delta) {
+        freq[c] += delta;
+        for (int i = c + 1; i <= SYMBOLS; i += i & -i) {
+            tree[i] += delta;
+        }
+        total += delta;
+    }
+
+    // Symbol whose range [low, low + freq) contains scaled_value, found by
+    // descending the tree; SYMBOLS if scaled_value >= total.
+    int find(uint32_t scaled_value, uint32_t& low) const {
+        int pos = 0;
+        uint32_t rest = scaled_value;
+        for (int step = TOP_STEP; step != 0; step >>= 1) {
+            int next = pos + step;
+            if (next <= SYMBOLS && tree[next] <= rest) {
+                pos = next;
+                rest -= tree[next];
+            }
+        }
+        low = scaled_value - rest;
+        return pos;
+    }
+
+    // Halves every frequency, keeping each at least 1.
+    void halve() {
+        for (int i = 0; i < SYMBOLS; ++i) {
+            freq[i] = (freq[i] + 1) / 2;
+        }
+        build();
+    }
+};
+
+// Adaptive order-0 model. Every symbol starts with frequency 1 and
+// adaptation stops once the total reaches MAX_FREQUENCY.
+template <int FreqBits>
+class BasicFrequencyModel {
+private:
+    static_assert(FreqBits > 9 && FreqBits < 32, "BasicFrequencyModel: 257 symbols need 9 bits");
+
+    static constexpr uint32_t FREQUENCY_BITS = FreqBits;
+    static constexpr uint32_t MAX_FREQUENCY = (uint32_t(1) << FREQUENCY_BITS) - 1;
+    bool is_full;
+
+    FenwickTable<uint32_t> table;
+
+    void update(int c) {
+        table.add(c, 1);
+        if (table.total >= MAX_FREQUENCY) {
+            is_full = true;
+            STATS_ADD(BAC_FREEZES, 1);
+            // every symbol starts at 1 and each update adds 1
+            STATS_SET(BAC_FREEZE_AT, table.total - FenwickTable<uint32_t>::SYMBOLS);
+        }
+    }
+
+public:
+    BasicFrequencyModel() {
+        reset();
+    }
+
+    void reset() {
+        table.init();
+        is_full = false;
+    }
+
+    Probability getProbability(int c) {
+        uint32_t low = table.cumulative(c);
+        Probability prob = {low, low + table.freq[c], table.total};
+        if (!is_full) {
+            update(c);
+        }
+        return prob;
+    }
+
+    Probability getChar(uint32_t scaled_value, int &c) {
+        uint32_t low;
+        c = table.find(scaled_value, low);
+        if (c >= FenwickTable<uint32_t>::SYMBOLS) {
+            throw std::logic_error("Error in getChar");
+        }
+
+        Probability prob = {low, low + table.freq[c], table.total};
+        if (!is_full) {
+            update(c);
+        }
+        return prob;
+    }
+
+    uint32_t getCount() const {
+        return table.total;
+    }
+};
+
+// the model the original BAC format is defined with
+using FrequencyModel = BasicFrequencyModel<15>;
+
+// Adaptive order-0/1/2 model: one frequency table per context of the
+// previous `order` bytes. A table that would exceed MAX_FREQUENCY is halved
+// rather than frozen, so the model keeps tracking non-stationary input.
+// Tables hold 16-bit counts (about 1 KiB each) and are allocated on first
+// use of their context, so order 2 costs memory only for the contexts the
+// input actually contains.
+class ContextModel {
+private:
+    using Table = FenwickTable<uint16_t>;
+
+    static constexpr uint32_t FREQUENCY_BITS = 15;
+    static constexpr uint32_t MAX_FREQUENCY = (uint32_t(1) << FREQUENCY_BITS) - 1;
+    static constexpr uint32_t INCREMENT = 32;
+    static constexpr uint32_t NO_TABLE = 0xFFFFFFFF;
+    static constexpr int EOF_CODE = 256;
+
+    uint32_t mask;
+    uint32_t context = 0;
+    std::vector<uint32_t> table_of; // context -> index into tables
+    std::vector<Table> tables;
+
+    Table& current() {
+        uint32_t& idx = table_of[context];
+        if (idx == NO_TABLE) {
+            idx = tables.size();
+            tables.emplace_back();
+            tables.back().init();
+        }
+        return tables[idx];
+    }
+
+    void update(Table& t, int c) {
+        if (t.total + INCREMENT > MAX_FREQUENCY) {
+            t.halve();
+        }
+        t.add(c, INCREMENT);
+        if (c != EOF_CODE) {
+            context = ((context << 8) | c) & mask;
+        }
+    }
+
+public:
+    static constexpr int MAX_ORDER = 2;
+
+    explicit ContextModel(int order) {
+        if (order < 0 || order > MAX_ORDER) {
+            throw std::invalid_argument("ContextModel: unsupported order");
+        }
+        mask = (uint32_t(1) << (8 * order)) - 1;
+        table_of.resize(size_t(mask) + 1);
+        reset();
+    }
+
+    void reset() {
+        std::fill(table_of.begin(), table_of.end(), NO_TABLE);
+        tables.clear();
+        context = 0;
+    }
+
+    Probability getProbability(int c) {
+        Table& t = current();
+        uint32_t low = t.cumulative(c);
+        Probability prob = {low, low + t.freq[c], t.total};
+        update(t, c);
+        return prob;
+    }
+
+    Probability getChar(uint32_t scaled_value, int &c) {
+        Table& t = current();
+        uint32_t low;
+        c = t.find(scaled_value, low);
+        if (c >= Table::SYMBOLS) {
+            throw std::logic_error("Error in getChar");
+        }
+
+        Probability prob = {low, low + t.freq[c], t.total};
+        update(t, c);
+        return prob;
+    }
+
+    uint32_t getCount() {
+        return current().total;
+    }
+};
@@ -0,0 +1,300 @@
+// Microbenchmarks of the coding kernels on fixed in-memory buffers, one
+// table per kernel. With a kernel name as the argument only that one runs:
+//
+//   kernel_bench [bitstream|model|lzw-dict|chunk|codec]
+//
+// Build: g++ -std=c++20 -O2 -pthread kernel_bench.cpp -o kernel_bench
+#include "codec_api.hpp"
+#include "lzw.hpp"
+#include "bac.hpp"
+#include "range_coder.hpp"
+#include "rans.hpp"
+#include "lzss.hpp"
+#include "auto_codec.hpp"
+#include "dedup.hpp"
+
+#include "algorithm"
+#include "chrono"
+#include "iomanip"
+#include "iostream"
+#include "random"
+#include "span"
+#include "string"
+#include "tuple"
+#include "vector"
+
+
+using Clock = std::chrono::steady_clock;
+
+double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// English-like text from a small vocabulary, so the dictionary coders
+// have something to find.
+std::vector<unsigned char> MakeText(size_t size, std::mt19937& rng) {
+    const char* words[] = {"the ", "archive ", "codec ", "block ", "of ", "stream ", "bits", ".\n",
+                           "and ", "model ", "window ", "match ", "a ", "dictionary ", "entropy ", "to "};
+    std::vector<unsigned char> text;
+    text.reserve(size + 16);
+    std::geometric_distribution<int> pick(0.2);
+    while (text.size() < size) {
+        for (const char* p = words[std::min(pick(rng), 15)]; *p; ++p) {
+            text.push_back(static_cast<unsigned char>(*p));
+        }
+    }
+    text.resize(size);
+    return text;
+}
+
+// writeBits/readBits of random values at one width, in memory.
+void BenchBitStream() {
+    const size_t total_bits = size_t(1) << 28; // 32 MB of payload per width
+    std::mt19937 rng(42);
+    std::cout << "bitstream\n" << std::setw(8) << "width"
+              << std::setw(14) << "write MB/s" << std::setw(14) << "read MB/s" << '\n';
+
+    for (int bits : {1, 5, 8, 9, 12, 17, 24, 32}) {
+        std::vector<uint32_t> vals(total_bits / bits);
+        for (uint32_t& v : vals) {
+            v = bits == 32 ? rng() : rng() & ((uint32_t(1) << bits) - 1);
+        }
+        std::vector<unsigned char> packed;
+        packed.reserve(total_bits / 8 + 8);
+
+        auto start = Clock::now();
+        {
+            BitStream fo(std::make_unique<VectorSink>(packed));
+            for (uint32_t v : vals) {
+                fo.writeBits(v, bits);
+            }
+            fo.finish();
+        }
+        double write = Seconds(start);
+
+        start = Clock::now();
+        BitStream fi(std::make_unique<MemorySource>(packed.data(), packed.size()));
+        uint32_t mismatches = 0;
+        for (uint32_t v : vals) {
+            mismatches += fi.readBits(bits) != v;
+        }
+        double read = Seconds(start);
+        if (mismatches != 0) {
+            throw std::logic_error("kernel_bench: bitstream read back a different value");
+        }
+
+        double mb = double(total_bits) / 8 / (1 << 20);
+        std::cout << std::setw(8) << bits << std::setw(14) << mb / write << std::setw(14) << mb / read << '\n';
+    }
+}
+
+// getProbability (lookup + update) and getChar (search + update) per
+// symbol; models are reset every RESET_PERIOD symbols so that the legacy
+// models don't spend the run frozen.
+template <class M, class... Args>
+void BenchModel(const char* name, const std::vector<unsigned char>& symbols, Args... args) {
+    const size_t RESET_PERIOD = 1 << 16;
+    std::vector<uint32_t> lows(symbols.size());
+
+    M model(args...);
+    auto start = Clock::now();
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        if (i % RESET_PERIOD == 0) {
+            model.reset();
+        }
+        lows[i] = model.getProbability(symbols[i]).low;
+    }
+    double encode = Seconds(start);
+
+    M decoder(args...);
+    start = Clock::now();
+    size_t mismatches = 0;
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        if (i % RESET_PERIOD == 0) {
+            decoder.reset();
+        }
+        int c;
+        decoder.getChar(lows[i], c);
+        mismatches += c != symbols[i];
+    }
+    double decode = Seconds(start);
+    if (mismatches != 0) {
+        throw std::logic_error("kernel_bench: model decoded a different symbol");
+    }
+
+    double n = symbols.size();
+    std::cout << std::setw(14) << name << std::setw(16) << encode * 1e9 / n
+              << std::setw(16) << decode * 1e9 / n << '\n';
+}
+
+void BenchModels() {
+    std::mt19937 rng(42);
+    std::vector<unsigned char> text = MakeText(size_t(1) << 24, rng);
+    std::cout << "model\n" << std::setw(14) << "model"
+              << std::setw(16) << "update ns/sym" << std::setw(16) << "lookup ns/sym" << '\n';
+    BenchModel<BAC::Model>("bac", text);
+    BenchModel<BAC32::Model>("bac32", text);
+    BenchModel<ContextModel>("context-o1", text, 1);
+    BenchModel<ContextModel>("context-o2", text, 2);
+}
+
+// Inserts of new (prefix, byte) keys into a cleared table up to a full
+// 2^20-entry dictionary, then lookups that hit and lookups that miss.
+void BenchLzwDictionary() {
+    const uint32_t entries = uint32_t(1) << 20;
+    const int rounds = 8;
+    std::mt19937 rng(42);
+    std::vector<uint32_t> keys(entries);
+    for (uint32_t code = 0; code < entries; ++code) {
+        // every code extends an earlier one, as in the encoder
+        uint32_t prefix = code < 256 ? rng() % 256 : rng() % code;
+        keys[code] = LZW::CodeTable::key(prefix, rng() % 256);
+    }
+
+    LZW::CodeTable table;
+    double insert = 0, hit = 0, miss = 0;
+    uint64_t found = 0;
+    for (int r = 0; r < rounds; ++r) {
+        table.clear();
+        auto start = Clock::now();
+        for (uint32_t code = 0; code < entries; ++code) {
+            auto& slot = table.probe(keys[code]);
+            if (!LZW::CodeTable::found(slot)) {
+                table.insert(slot, keys[code], code);
+            }
+        }
+        insert += Seconds(start);
+
+        start = Clock::now();
+        for (uint32_t key : keys) {
+            found += LZW::CodeTable::found(table.probe(key));
+        }
+        hit += Seconds(start);
+
+        start = Clock::now();
+        for (uint32_t key : keys) {
+            // byte values are < 256, so flipping the prefix's top bit misses
+            found += LZW::CodeTable::found(table.probe(key ^ 0x80000000u));
+        }
+        miss += Seconds(start);
+    }
+    if (found != uint64_t(entries) * rounds) {
+        throw std::logic_error("kernel_bench: lzw dictionary lookups went wrong");
+    }
+
+    double n = double(entries) * rounds;
+    std::cout << "lzw-dict\n" << std::setw(14) << "insert ns" << std::setw(14) << "hit ns"
+              << std::setw(14) << "miss ns" << '\n'
+              << std::setw(14) << insert * 1e9 / n << std::setw(14) << hit * 1e9 / n
+              << std::setw(14) << miss * 1e9 / n << '\n';
+}
+
+// Content-defined chunking and fingerprinting of the chunks, the work
+// --dedup adds per input byte.
+void BenchChunking() {
+    const size_t size = size_t(1) << 26;
+    std::mt19937 rng(42);
+    std::vector<unsigned char> text = MakeText(size, rng);
+
+    auto start = Clock::now();
+    std::vector<size_t> cuts;
+    for (size_t at = 0; at < size; ) {
+        at += Chunker::Cut(text.data() + at, size - at);
+        cuts.push_back(at);
+    }
+    double cut = Seconds(start);
+
+    start = Clock::now();
+    std::vector<Fingerprint> prints;
+    for (size_t i = 0, at = 0; i < cuts.size(); at = cuts[i++]) {
+        prints.push_back(Fingerprint::Of(text.data() + at, cuts[i] - at));
+    }
+    double hash = Seconds(start);
+
+    for (size_t i = 0, at = 0; i + 1 < cuts.size(); at = cuts[i++]) {
+        if (cuts[i] - at < Chunker::MIN_SIZE || cuts[i] - at > Chunker::MAX_SIZE) {
+            throw std::logic_error("kernel_bench: chunk size out of bounds");
+        }
+    }
+    std::sort(prints.begin(), prints.end());
+    if (std::adjacent_find(prints.begin(), prints.end()) != prints.end()) {
+        throw std::logic_error("kernel_bench: chunks of random text share a fingerprint");
+    }
+
+    double mb = double(size) / (1 << 20);
+    std::cout << "chunk\n" << std::setw(14) << "cut MB/s" << std::setw(18) << "fingerprint MB/s"
+              << std::setw(14) << "avg chunk" << '\n'
+              << std::setw(14) << mb / cut << std::setw(18) << mb / hash
+              << std::setw(14) << size / cuts.size() << '\n';
+}
+
+// Whole-buffer encode and decode through the span API.
+void BenchCodecs() {
+    const size_t size = size_t(1) << 22;
+    std::mt19937 rng(42);
+    std::vector<unsigned char> text = MakeText(size, rng);
+    std::vector<unsigned char> random(size);
+    for (unsigned char& c : random) {
+        c = static_cast<unsigned char>(rng());
+    }
+
+    const std::tuple<const char*, Codec, Codec> codecs[] = {
+        {"lzw", CompressorOf<LZW>(), DecompressorOf<LZW>()},
+        {"bac", CompressorOf<BAC>(), DecompressorOf<BAC>()},
+        {"bac32", CompressorOf<BAC32>(), DecompressorOf<BAC32>()},
+        {"bac-o2", CompressorOf<BAC>(2), DecompressorOf<BAC>(2)},
+        {"range", CompressorOf<RangeCoder>(), DecompressorOf<RangeCoder>()},
+        {"rans", CompressorOf<RANS>(), DecompressorOf<RANS>()},
+        {"lzss-1", CompressorOf<LZSS>(1), DecompressorOf<LZSS>()},
+        {"lzss-6", CompressorOf<LZSS>(6), DecompressorOf<LZSS>()},
+        {"lzss-9", CompressorOf<LZSS>(9), DecompressorOf<LZSS>()},
+        {"auto", CompressorOf<AutoCodec>(), DecompressorOf<AutoCodec>()},
+    };
+
+    std::cout << std::setprecision(3);
+    for (auto& [title, input] : {std::pair{"text", &text}, std::pair{"random", &random}}) {
+        std::cout << "codec " << title << '\n' << std::setw(14) << "codec" << std::setw(10) << "ratio"
+                  << std::setw(16) << "encode MB/s" << std::setw(16) << "decode MB/s" << '\n';
+        auto in = std::as_bytes(std::span(*input));
+        for (auto& [name, compress, decompress] : codecs) {
+            auto start = Clock::now();
+            std::vector<std::byte> packed = Encode(compress, in);
+            double encode = Seconds(start);
+            start = Clock::now();
+            std::vector<std::byte> unpacked = Encode(decompress, packed);
+            double decode = Seconds(start);
+            if (!std::equal(unpacked.begin(), unpacked.end(), in.begin(), in.end())) {
+                throw std::logic_error(std::string("kernel_bench: ") + name + " round trip failed");
+            }
+            double mb = double(size) / (1 << 20);
+            std::cout << std::setw(14) << name << std::setw(10) << double(size) / packed.size()
+                      << std::setw(16) << mb / encode << std::setw(16) << mb / decode << '\n';
+        }
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    std::string only = argc > 1 ? argv[1] : "";
+    const std::pair<const char*, void (*)()> kernels[] = {
+        {"bitstream", BenchBitStream},
+        {"model", BenchModels},
+        {"lzw-dict", BenchLzwDictionary},
+        {"chunk", BenchChunking},
+        {"codec", BenchCodecs},
+    };
+
+    std::cout << std::fixed << std::setprecision(2);
+    bool ran = false;
+    for (auto& [name, bench] : kernels) {
+        if (only.empty() || only == name) {
+            bench();
+            ran = true;
+        }
+    }
+    if (!ran) {
+        std::cout << "Unknown kernel: " << only << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,377 @@
+#pragma once
+
+#include "bitstream.hpp"
+
+#include "algorithm"
+#include "cstdint"
+#include "cstring"
+#include "stdexcept"
+#include "string"
+#include "vector"
+
+
+// LZ77 with LZSS tokens over a 64 KiB sliding window. The output is byte
+// aligned, so a byte-oriented entropy stage such as BAC sees literals,
+// lengths and distances as whole symbols:
+//
+//   window bits(8) | group*
+//   group: flags(8) | up to 8 tokens, flag bit 7 first, 1 = match
+//   literal: byte
+//   match: length - MIN_MATCH(8) | distance - 1(16)
+//
+// and a match whose length byte is END_CODE (no distance) ends the stream.
+//
+// Matches are found through hash chains over 3-byte prefixes. The level
+// picks the parse: 1-3 greedy with 1 to 8 probes, 4-8 lazy (a match is
+// put off when the next position has a longer one) with up to 512 probes,
+// 9 optimal, choosing the cheapest token sequence over blocks of
+// OPTIMAL_BLOCK positions. Token costs are fixed in this format, so the
+// parse is exact for the matches found; positions covered by a match of
+// nice length are not searched.
+class LZSS {
+public:
+    static constexpr int MIN_LEVEL = 1;
+    static constexpr int MAX_LEVEL = 9;
+    static constexpr int DEFAULT_LEVEL = 6;
+
+private:
+    static constexpr int BYTE_SIZE = 8;
+    static constexpr int WINDOW_BITS = 16;
+    static constexpr size_t WINDOW = size_t(1) << WINDOW_BITS;
+    static constexpr size_t MIN_MATCH = 3;
+    static constexpr int END_CODE = 255;
+    static constexpr size_t MAX_MATCH = MIN_MATCH + END_CODE - 1;
+    static constexpr int HASH_BITS = 15;
+    static constexpr int32_t NIL = -1;
+    static constexpr size_t OPTIMAL_BLOCK = 4096;
+    static constexpr int LITERAL_COST = 9; // bits, with its flag
+    static constexpr int MATCH_COST = 25;
+
+    struct Level {
+        int chain;   // candidates probed per position
+        size_t nice; // a match this long is taken as is
+        bool lazy;
+        bool optimal;
+    };
+
+    static constexpr Level LEVELS[MAX_LEVEL + 1] = {
+        {0, 0, false, false}, // unused
+        {1, 16, false, false},
+        {4, 32, false, false},
+        {8, 64, false, false},
+        {8, 32, true, false},
+        {16, 64, true, false},
+        {32, 128, true, false},
+        {128, MAX_MATCH, true, false},
+        {512, MAX_MATCH, true, false},
+        {256, 128, false, true},
+    };
+
+    struct Match {
+        size_t length = 0;
+        size_t distance = 0;
+    };
+
+    Level level;
+
+    // encoder: [0, end) of buf holds input, head/prev are positions in it
+    std::vector<unsigned char> buf;
+    size_t end = 0;
+    bool input_done = false;
+    std::vector<int32_t> head;
+    std::vector<int32_t> prev;
+
+    // encoder: the group being assembled
+    unsigned char group[1 + 8 * 3];
+    size_t group_size = 1;
+    int group_tokens = 0;
+
+    static uint32_t hash(const unsigned char* p) {
+        uint32_t v = uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2];
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    void insert(size_t pos) {
+        if (pos + MIN_MATCH > end) {
+            return;
+        }
+        uint32_t h = hash(&buf[pos]);
+        prev[pos & (WINDOW - 1)] = head[h];
+        head[h] = static_cast<int32_t>(pos);
+    }
+
+    // Longest match for pos among the chained earlier positions; pos
+    // itself must not be inserted yet.
+    Match find(size_t pos) const {
+        Match best;
+        size_t limit = std::min(MAX_MATCH, end - pos);
+        if (limit < MIN_MATCH) {
+            return best;
+        }
+        const unsigned char* cur = &buf[pos];
+        int32_t cand = head[hash(cur)];
+        for (int probes = level.chain; cand != NIL && probes > 0; --probes) {
+            size_t distance = pos - cand;
+            if (distance > WINDOW) {
+                break;
+            }
+            const unsigned char* p = &buf[cand];
+            if (p[best.length] == cur[best.length] && p[0] == cur[0]) {
+                size_t n = 0;
+                while (n < limit && p[n] == cur[n]) {
+                    ++n;
+                }
+                if (n > best.length) {
+                    best.length = n;
+                    best.distance = distance;
+                    if (n >= level.nice || n == limit) {
+                        break;
+                    }
+                }
+            }
+            int32_t next = prev[cand & (WINDOW - 1)];
+            // a slot reused by a newer position ends the chain
+            if (next >= cand) {
+                break;
+            }
+            cand = next;
+        }
+        if (best.length < MIN_MATCH) {
+            best.length = 0;
+        }
+        return best;
+    }
+
+    void flushGroup(BitStream& fo) {
+        if (group_tokens == 0) {
+            return;
+        }
+        group[0] <<= 8 - group_tokens;
+        fo.writeBytes(group, group_size);
+        group[0] = 0;
+        group_size = 1;
+        group_tokens = 0;
+    }
+
+    void token(bool is_match) {
+        group[0] = static_cast<unsigned char>(group[0] << 1 | is_match);
+        ++group_tokens;
+    }
+
+    void literal(BitStream& fo, unsigned char c) {
+        token(false);
+        group[group_size++] = c;
+        if (group_tokens == 8) {
+            flushGroup(fo);
+        }
+    }
+
+    void match(BitStream& fo, size_t length, size_t distance) {
+        token(true);
+        group[group_size++] = static_cast<unsigned char>(length - MIN_MATCH);
+        group[group_size++] = static_cast<unsigned char>((distance - 1) >> 8);
+        group[group_size++] = static_cast<unsigned char>(distance - 1);
+        if (group_tokens == 8) {
+            flushGroup(fo);
+        }
+    }
+
+    void fill(BitStream& fi) {
+        while (!input_done && end < buf.size()) {
+            size_t n = fi.readBytes(&buf[end], buf.size() - end);
+            if (n == 0) {
+                input_done = true;
+            }
+            end += n;
+        }
+    }
+
+    // Drops the oldest WINDOW bytes once pos is past them.
+    void slide(size_t& pos) {
+        std::memmove(buf.data(), buf.data() + WINDOW, end - WINDOW);
+        end -= WINDOW;
+        pos -= WINDOW;
+        auto rebase = [](int32_t& v) {
+            v = v >= int32_t(WINDOW) ? v - int32_t(WINDOW) : NIL;
+        };
+        std::for_each(head.begin(), head.end(), rebase);
+        std::for_each(prev.begin(), prev.end(), rebase);
+    }
+
+    // Codes positions [pos, pos + n) with the cheapest token sequence.
+    void parseOptimal(BitStream& fo, size_t pos, size_t n) {
+        std::vector<Match> matches(n);
+        size_t skip_to = 0;
+        for (size_t i = 0; i < n; ++i) {
+            // inside a match of nice length the other choices hardly
+            // matter, and searching there is most of the cost on runs
+            if (i >= skip_to) {
+                matches[i] = find(pos + i);
+                matches[i].length = std::min(matches[i].length, n - i);
+                if (matches[i].length >= level.nice) {
+                    skip_to = i + matches[i].length;
+                }
+            }
+            insert(pos + i);
+        }
+        // cost[i]: bits to code [pos + i, pos + n); choice[i]: 0 = literal
+        std::vector<uint32_t> cost(n + 1, 0);
+        std::vector<uint16_t> choice(n, 0);
+        for (size_t i = n; i-- > 0;) {
+            cost[i] = cost[i + 1] + LITERAL_COST;
+            for (size_t len = MIN_MATCH; len <= matches[i].length; ++len) {
+                if (cost[i + len] + MATCH_COST <= cost[i]) {
+                    cost[i] = cost[i + len] + MATCH_COST;
+                    choice[i] = static_cast<uint16_t>(len);
+                }
+            }
+        }
+        for (size_t i = 0; i < n;) {
+            if (choice[i] == 0) {
+                literal(fo, buf[pos + i]);
+                ++i;
+            } else {
+                match(fo, choice[i], matches[i].distance);
+                i += choice[i];
+            }
+        }
+    }
+
+public:
+    LZSS(int level = DEFAULT_LEVEL) {
+        if (level < MIN_LEVEL || level > MAX_LEVEL) {
+            throw std::invalid_argument("LZSS: level must be in 1..9");
+        }
+        this->level = LEVELS[level];
+    }
+
+    void Compress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Compress(fi, fo);
+    }
+
+    void Compress(BitStream& fi, BitStream& fo) {
+        buf.assign(2 * WINDOW, 0);
+        end = 0;
+        input_done = false;
+        head.assign(size_t(1) << HASH_BITS, NIL);
+        prev.assign(WINDOW, NIL);
+        group[0] = 0;
+        group_size = 1;
+        group_tokens = 0;
+
+        fo.writeBits(WINDOW_BITS, BYTE_SIZE);
+
+        // bytes needed ahead of pos before a token is coded
+        const size_t lookahead = level.optimal ? OPTIMAL_BLOCK + MAX_MATCH : MAX_MATCH + 1;
+        size_t pos = 0;
+        fill(fi);
+        while (true) {
+            if (end - pos < lookahead && !input_done) {
+                // buf is full here, so pos > 2 * WINDOW - lookahead >= WINDOW
+                slide(pos);
+                fill(fi);
+                continue;
+            }
+            if (pos >= end) {
+                break;
+            }
+
+            if (level.optimal) {
+                size_t n = std::min(OPTIMAL_BLOCK, end - pos);
+                parseOptimal(fo, pos, n);
+                pos += n;
+                continue;
+            }
+
+            Match m = find(pos);
+            insert(pos);
+            if (level.lazy) {
+                // take a literal while the next position matches longer
+                while (m.length != 0 && m.length < level.nice && pos + 1 < end) {
+                    Match next = find(pos + 1);
+                    if (next.length <= m.length) {
+                        break;
+                    }
+                    literal(fo, buf[pos]);
+                    ++pos;
+                    insert(pos);
+                    m = next;
+                }
+            }
+            if (m.length == 0) {
+                literal(fo, buf[pos]);
+                ++pos;
+                continue;
+            }
+            match(fo, m.length, m.distance);
+            for (size_t i = 1; i < m.length; ++i) {
+                insert(pos + i);
+            }
+            pos += m.length;
+        }
+
+        token(true);
+        group[group_size++] = END_CODE;
+        flushGroup(fo);
+    }
+
+    void Decompress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Decompress(fi, fo);
+    }
+
+    // Keeps the last WINDOW bytes of output for the matches and writes
+    // the rest out whenever the buffer fills.
+    void Decompress(BitStream& fi, BitStream& fo) {
+        std::vector<unsigned char> out(2 * WINDOW + MAX_MATCH);
+        size_t n = 0;       // bytes in out
+        size_t written = 0; // of which already written
+
+        auto next = [&fi]() {
+            int c = fi.getByte();
+            if (c == std::istream::traits_type::eof()) {
+                throw std::runtime_error("LZSS: truncated input");
+            }
+            return static_cast<unsigned char>(c);
+        };
+
+        if (next() != WINDOW_BITS) {
+            throw std::runtime_error("LZSS: corrupted input, bad window size");
+        }
+        while (true) {
+            unsigned char flags = next();
+            for (int t = 0; t < 8; ++t, flags <<= 1) {
+                if (n > 2 * WINDOW) {
+                    fo.writeBytes(&out[written], n - written);
+                    std::memmove(out.data(), out.data() + n - WINDOW, WINDOW);
+                    n = written = WINDOW;
+                }
+                if (!(flags & 0x80)) {
+                    out[n++] = next();
+                    continue;
+                }
+                int code = next();
+                if (code == END_CODE) {
+                    fo.writeBytes(&out[written], n - written);
+                    return;
+                }
+                size_t length = code + MIN_MATCH;
+                size_t distance = size_t(next()) << 8;
+                distance = (distance | next()) + 1;
+                // after the first slide n >= WINDOW covers every distance
+                if (distance > n) {
+                    throw std::runtime_error("LZSS: corrupted input, distance out of range");
+                }
+                // may overlap itself: a run copies what it just wrote
+                const unsigned char* src = &out[n - distance];
+                for (size_t i = 0; i < length; ++i) {
+                    out[n + i] = src[i];
+                }
+                n += length;
+            }
+        }
+    }
+};
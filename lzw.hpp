@@ -1,153 +1,333 @@
+#pragma once
+
 #include "bitstream.hpp"
 
 #include "cstdint" //uint32
-#include "unordered_map"
 #include "string"
+#include "vector"
+#include "algorithm"
+#include "type_traits"
 
 #include "iostream"
+#include "stdexcept"
 
 
 class LZW {
-private:
-    std::unordered_map<std::string, uint32_t> compress;
-    std::unordered_map<uint32_t, std::string> decompress;
+public:
+    // Encoder dictionary: maps (prefix code, next byte) to the code of the
+    // extended string. Single bytes are their own codes and are not stored.
+    // Open addressing with linear probing; the slot array only ever grows,
+    // so after warm-up the encoder loop does not allocate. Public for
+    // kernel_bench.
+    class CodeTable {
+    private:
+        struct Slot {
+            uint32_t key;
+            uint32_t code;
+        };
 
-    const uint32_t MAX_CODE = 4194304; // 2^22
-    const int BYTE_SIZE = 8;
-    const int START_CODE = fastPow(2, BYTE_SIZE) - 1;
+        static constexpr uint32_t EMPTY = 0xFFFFFFFF;
+        static constexpr int START_BITS = 16;
 
-    bool isPowerOfTwo(uint32_t x) {
-        return (x != 0) && ((x & (x - 1)) == 0);
-    }
+        std::vector<Slot> slots;
+        uint32_t used = 0;
+        int shift = 32 - START_BITS;
 
-    int fastPow(int base, int pow) {
-        int res = 1;
-        int curmult = base;
-        int curpow = pow;
-        while (curpow != 0) {
-            if (curpow % 2 == 1) {
-                res *= curmult;
-            }
-            curpow >>= 1;
-            curmult *= curmult;
+        uint32_t index(uint32_t key) const {
+            return (key * 0x9E3779B1u) >> shift;
         }
-        return res;
-}
 
-public:
-    LZW() {
-        resetDicts();
-    }
-    void resetDicts() {
-        compress.clear();
-        decompress.clear();
-        for (uint32_t i = 0; i <= 255; ++i) {
-            compress[std::string(1, char(i))] = i;
-            decompress[i] = std::string(1, char(i));
+        void grow() {
+            std::vector<Slot> old(slots.size() * 2, Slot{EMPTY, 0});
+            old.swap(slots);
+            --shift;
+            uint32_t mask = slots.size() - 1;
+            for (const Slot& s : old) {
+                if (s.key != EMPTY) {
+                    uint32_t i = index(s.key);
+                    while (slots[i].key != EMPTY) {
+                        i = (i + 1) & mask;
+                    }
+                    slots[i] = s;
+                }
+            }
         }
-    }
-
-    void Compress(std::string in, std::string out) {
-        BitStream fi(in, "r");
-        BitStream fo(out,"w");
 
-        uint32_t cur_max_code = 255;
-        int code_length = BYTE_SIZE;
+    public:
+        CodeTable() : slots(size_t(1) << START_BITS, Slot{EMPTY, 0}) {}
 
-        std::string s = "";
-        char cur;
+        static uint32_t key(uint32_t prefix, uint32_t byte) {
+            return (prefix << 8) | byte;
+        }
 
-        while (true) {
-            try {
-                cur = fi.readBits(BYTE_SIZE);
-            } catch (EOFReachedException& ex) {
-                break;
+        // Returns the slot holding `key`, or the empty slot where it belongs.
+        Slot& probe(uint32_t key) {
+            uint32_t mask = slots.size() - 1;
+            uint32_t i = index(key);
+            while (slots[i].key != key && slots[i].key != EMPTY) {
+                i = (i + 1) & mask;
             }
+            return slots[i];
+        }
 
-            if (compress.count(s + cur) == 1) {
-                s += cur;
-            } else {
-                fo.writeBits(compress[s], code_length);
-                compress[s + cur] = ++cur_max_code;
+        static bool found(const Slot& s) {
+            return s.key != EMPTY;
+        }
 
-                if (isPowerOfTwo(cur_max_code)) {
-                    code_length += 1;
-                }
-                s = cur;
+        // `s` must be the empty slot returned by probe(key).
+        void insert(Slot& s, uint32_t key, uint32_t code) {
+            s.key = key;
+            s.code = code;
+            if (++used * 2 > slots.size()) {
+                grow();
             }
+        }
 
-            if (cur_max_code == MAX_CODE) {
-                fo.writeBits(compress[s], code_length);
-                s = "";
-                resetDicts();
-                cur_max_code = 255;
-                code_length = BYTE_SIZE;
-            }
+        void clear() {
+            std::fill(slots.begin(), slots.end(), Slot{EMPTY, 0});
+            used = 0;
+        }
+    };
+
+private:
+    // Decoder dictionary, indexed by code: a string is its prefix string
+    // followed by one byte.
+    struct Entry {
+        uint32_t prefix;
+        uint32_t length;
+        unsigned char last;
+    };
+
+    CodeTable compress;
+    std::vector<Entry> decompress;
+
+    static constexpr int BYTE_SIZE = 8;
+    static constexpr uint32_t CLEAR_CODE = 256;
+    static constexpr uint32_t FIRST_CODE = 257; // first string code
+    static constexpr int HEADER_BITS = 8;
+    // once the dictionary is full the ratio is checked every CHECK_GAP
+    // input bytes
+    static constexpr uint64_t CHECK_GAP = 10000;
 
+    int max_bits;
+
+    // Writes the string of `code` straight into the output buffer, back to
+    // front along its prefix chain, and returns its first byte.
+    unsigned char emit(uint32_t code, BitStream& fo) {
+        uint32_t length = decompress[code].length;
+        unsigned char* dst = fo.reserveBytes(length);
+        for (uint32_t i = length; i-- > 0;) {
+            dst[i] = decompress[code].last;
+            code = decompress[code].prefix;
         }
-        if (!s.empty()) {
-            fo.writeBits(compress[s], code_length);
+        return dst[0];
+    }
+
+    // Calls f(std::integral_constant<int, bits>()) for Bits <= bits <=
+    // MAX_BITS, so every code width gets coding loops of its own.
+    template <int Bits, class F>
+    static void withBits(int bits, F&& f) {
+        if constexpr (Bits < MAX_BITS) {
+            if (bits != Bits) {
+                withBits<Bits + 1>(bits, f);
+                return;
+            }
         }
+        f(std::integral_constant<int, Bits>());
     }
 
-    void Decompress(std::string in, std::string out) {
-        BitStream fi(in, "r");
-        BitStream fo(out,"w");
+    template <int MaxBits>
+    void encode(BitStream& fi, BitStream& fo) {
+        resetDicts();
+        fo.writeBits(MaxBits, HEADER_BITS);
 
-        uint32_t cur_max_code = 255;
-        uint32_t code_length = BYTE_SIZE;
-        uint32_t prevcode;
+        const int EOF_CHAR = std::istream::traits_type::eof();
+        constexpr uint32_t limit = uint32_t(1) << MaxBits;
+        uint32_t next_code = FIRST_CODE;
+        int code_length = MIN_BITS;
 
-        try {
-            prevcode = fi.readBits(code_length);
-        } catch (EOFReachedException& ex) {
-            std::cout << "archive is empty!\n";
+        uint64_t in_bytes = 0;
+        uint64_t out_bits = 0;
+        uint64_t checkpoint = CHECK_GAP;
+        double best_ratio = 0;
+
+        int cur = fi.getByte();
+        if (cur == EOF_CHAR) {
+            return;
         }
+        ++in_bytes;
+        // code of the longest match so far
+        uint32_t s = cur;
 
-        fo.writeBits(decompress[prevcode][0], BYTE_SIZE);
-        std::string curstr = decompress[prevcode];
-        uint32_t curcode;
+        while ((cur = fi.getByte()) != EOF_CHAR) {
+            ++in_bytes;
+            uint32_t key = CodeTable::key(s, cur);
+            auto& slot = compress.probe(key);
+            if (CodeTable::found(slot)) {
+                s = slot.code;
+                continue;
+            }
 
-        while (true) {
+            fo.writeBits(s, code_length);
+            out_bits += code_length;
+            s = cur;
 
-            if (cur_max_code == MAX_CODE) {
-                code_length = BYTE_SIZE;
-                try {
-                    prevcode = fi.readBits(code_length);
-                } catch (EOFReachedException& ex) {
-                    break;
+            if (next_code < limit) {
+                compress.insert(slot, key, next_code++);
+                // the next code may be the one just added
+                if (next_code > (uint32_t(1) << code_length) && code_length < MaxBits) {
+                    ++code_length;
+                }
+            } else if (in_bytes >= checkpoint) {
+                checkpoint = in_bytes + CHECK_GAP;
+                double ratio = double(in_bytes) / out_bits;
+                // an expanding dictionary is cleared too, so one trained on
+                // incompressible data isn't kept for what follows
+                if (ratio > best_ratio && in_bytes * BYTE_SIZE >= out_bits) {
+                    best_ratio = ratio;
+                } else {
+                    STATS_ADD(LZW_RESETS, 1);
+                    STATS_MAX(LZW_PEAK_ENTRIES, next_code);
+                    fo.writeBits(CLEAR_CODE, code_length);
+                    resetDicts();
+                    next_code = FIRST_CODE;
+                    code_length = MIN_BITS;
+                    in_bytes = 1; // the pending byte in s
+                    out_bits = 0;
+                    checkpoint = CHECK_GAP;
+                    best_ratio = 0;
                 }
-                fo.writeBits(decompress[prevcode][0], BYTE_SIZE);
-                curstr = decompress[prevcode];
-                resetDicts();
-                cur_max_code = 255;
             }
+        }
+        STATS_MAX(LZW_PEAK_ENTRIES, next_code);
+        fo.writeBits(s, code_length);
+    }
 
+    template <int MaxBits>
+    void decode(BitStream& fi, BitStream& fo) {
+        constexpr uint32_t limit = uint32_t(1) << MaxBits;
+        uint32_t next_code = FIRST_CODE;
+        int code_length = MIN_BITS;
+        // no previous code right after the start and after CLEAR_CODE
+        bool have_prev = false;
+        uint32_t prevcode = 0;
+        // first byte of the string of prevcode
+        unsigned char first = 0;
 
-            if (isPowerOfTwo(cur_max_code+1)) {
-                code_length += 1;
+        while (true) {
+            // the encoder added an entry after the previous code: mirror the
+            // width change before reading
+            if (have_prev && next_code < limit
+                && next_code + 1 > (uint32_t(1) << code_length) && code_length < MaxBits) {
+                ++code_length;
             }
 
+            uint32_t curcode;
             try {
                 curcode = fi.readBits(code_length);
             } catch (EOFReachedException& ex) {
+                STATS_MAX(LZW_PEAK_ENTRIES, next_code);
                 break;
             }
 
-            if (decompress.count(curcode) != 1) {
-                curstr = curstr + curstr[0];
-                decompress[++cur_max_code] = curstr;
-
-            } else {
-                curstr = decompress[curcode];
-                decompress[++cur_max_code] = decompress[prevcode] + curstr[0];
+            if (curcode == CLEAR_CODE) {
+                STATS_ADD(LZW_RESETS, 1);
+                STATS_MAX(LZW_PEAK_ENTRIES, next_code);
+                resetDicts();
+                next_code = FIRST_CODE;
+                code_length = MIN_BITS;
+                have_prev = false;
+                continue;
+            }
+            if (!have_prev) {
+                if (curcode >= FIRST_CODE) {
+                    throw std::runtime_error("LZW: corrupted input, unknown code");
+                }
+                first = emit(curcode, fo);
+                prevcode = curcode;
+                have_prev = true;
+                continue;
             }
 
-            for (char c : curstr) {
-                fo.writeBits(c, BYTE_SIZE);
+            uint32_t length = decompress[prevcode].length + 1;
+            if (curcode < next_code) {
+                first = emit(curcode, fo);
+                if (next_code < limit) {
+                    decompress.push_back(Entry{prevcode, length, first});
+                    ++next_code;
+                }
+            } else if (curcode == next_code && next_code < limit) {
+                // the code being defined: previous string plus its own first byte
+                decompress.push_back(Entry{prevcode, length, first});
+                ++next_code;
+                emit(curcode, fo);
+            } else {
+                throw std::runtime_error("LZW: corrupted input, unknown code");
             }
             prevcode = curcode;
         }
     }
-};
 
+public:
+    static constexpr int MIN_BITS = 9;
+    static constexpr int MAX_BITS = 24;
+    static constexpr int DEFAULT_MAX_BITS = 20;
+
+    // Codes grow from MIN_BITS up to max_bits wide, so the dictionary holds
+    // at most 2^max_bits entries. The width is stored in the stream; the
+    // decoder ignores its own max_bits.
+    LZW(int max_bits = DEFAULT_MAX_BITS) : max_bits(max_bits) {
+        if (max_bits < MIN_BITS || max_bits > MAX_BITS) {
+            throw std::invalid_argument("LZW: code width must be 9..24 bits");
+        }
+        for (uint32_t i = 0; i <= 255; ++i) {
+            decompress.push_back(Entry{0, 1, static_cast<unsigned char>(i)});
+        }
+        // CLEAR_CODE has no string
+        decompress.push_back(Entry{0, 0, 0});
+        resetDicts();
+    }
+    void resetDicts() {
+        compress.clear();
+        // single-byte entries are never modified
+        decompress.resize(FIRST_CODE);
+    }
+
+    void Compress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Compress(fi, fo);
+    }
+
+    // Stream: max_bits(8), then codes. Like Unix compress, once the
+    // dictionary is full the encoder keeps it while the compression ratio
+    // since the last reset improves, and emits CLEAR_CODE to start over
+    // as soon as it drops or the output gets larger than the input.
+    void Compress(BitStream& fi, BitStream& fo) {
+        withBits<MIN_BITS>(max_bits, [&](auto width) {
+            encode<decltype(width)::value>(fi, fo);
+        });
+    }
+
+    void Decompress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Decompress(fi, fo);
+    }
+
+    void Decompress(BitStream& fi, BitStream& fo) {
+        resetDicts();
+        uint32_t bits;
+        try {
+            bits = fi.readBits(HEADER_BITS);
+        } catch (EOFReachedException& ex) {
+            return; // an empty stream decodes to nothing
+        }
+        if (bits < MIN_BITS || bits > MAX_BITS) {
+            throw std::runtime_error("LZW: corrupted input, bad code width");
+        }
+        withBits<MIN_BITS>(bits, [&](auto width) {
+            decode<decltype(width)::value>(fi, fo);
+        });
+    }
+};
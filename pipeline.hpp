@@ -0,0 +1,291 @@
+#pragma once
+
+#include "bitstream.hpp"
+#include "byte_io.hpp"
+
+#include "atomic"
+#include "condition_variable"
+#include "deque"
+#include "exception"
+#include "functional"
+#include "memory"
+#include "mutex"
+#include "stdexcept"
+#include "thread"
+#include "vector"
+
+
+// Bounded single-producer/single-consumer queue of byte chunks. push()
+// blocks while the queue is full, pop() while it is empty. close() marks
+// the end of the data; cancel() is the consumer giving up, after which
+// pushes are dropped instead of blocking and return false.
+class ByteChannel {
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<unsigned char>> chunks;
+    size_t capacity;
+    bool closed = false;
+    bool cancelled = false;
+
+public:
+    explicit ByteChannel(size_t capacity) : capacity(capacity) {}
+
+    bool push(std::vector<unsigned char> chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return cancelled || chunks.size() < capacity; });
+        if (cancelled) {
+            return false;
+        }
+        chunks.push_back(std::move(chunk));
+        changed.notify_all();
+        return true;
+    }
+
+    // Returns false once the channel is closed and drained, or cancelled.
+    bool pop(std::vector<unsigned char>& chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return cancelled || closed || !chunks.empty(); });
+        if (cancelled || chunks.empty()) {
+            return false;
+        }
+        chunk = std::move(chunks.front());
+        chunks.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        changed.notify_all();
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+        chunks.clear();
+        changed.notify_all();
+    }
+};
+
+// Closes the channel when the writing BitStream is done with it.
+class ChannelSink : public ByteSink {
+private:
+    ByteChannel& channel;
+
+public:
+    ChannelSink(ByteChannel& channel) : channel(channel) {}
+
+    ~ChannelSink() {
+        channel.close();
+    }
+
+    void write(const unsigned char* data, size_t size) override {
+        channel.push(std::vector<unsigned char>(data, data + size));
+    }
+};
+
+class ChannelSource : public ByteSource {
+private:
+    ByteChannel& channel;
+    std::vector<unsigned char> current;
+
+public:
+    ChannelSource(ByteChannel& channel) : channel(channel) {}
+
+    bool next(const unsigned char*& data, size_t& size) override {
+        do {
+            if (!channel.pop(current)) {
+                return false;
+            }
+        } while (current.empty());
+        data = current.data();
+        size = current.size();
+        return true;
+    }
+};
+
+
+// Reads a source on its own thread, `depth` chunks ahead of the consumer,
+// so pipe or disk latency overlaps with coding. An error of the source is
+// rethrown from next().
+class ReadAheadSource : public ByteSource {
+private:
+    std::unique_ptr<ByteSource> source;
+    ByteChannel channel;
+    ChannelSource reader;
+    std::exception_ptr error;
+    std::thread thread;
+
+public:
+    ReadAheadSource(std::unique_ptr<ByteSource> source, size_t depth = 2)
+    : source(std::move(source)), channel(depth), reader(channel) {
+        STATS_CONTEXT(stats_context);
+        thread = std::thread([this STATS_CAPTURE(stats_context)]() {
+            STATS_ADOPT(stats_context);
+            try {
+                const unsigned char* data;
+                size_t size;
+                auto read = [&]() {
+                    STATS_PHASE(READ);
+                    return this->source->next(data, size);
+                };
+                while (read()) {
+                    if (!channel.push(std::vector<unsigned char>(data, data + size))) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+            channel.close();
+        });
+    }
+
+    ReadAheadSource(const ReadAheadSource&) = delete;
+    ReadAheadSource& operator=(const ReadAheadSource&) = delete;
+
+    // the consumer may stop early: don't wait for the rest of the input
+    ~ReadAheadSource() {
+        channel.cancel();
+        thread.join();
+    }
+
+    bool next(const unsigned char*& data, size_t& size) override {
+        if (reader.next(data, size)) {
+            return true;
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return false;
+    }
+};
+
+// Writes to a sink on its own thread, so the coder doesn't wait for the
+// disk or the pipe. An error of the sink is rethrown from the next write()
+// or from close(), which waits until everything is written; the destructor
+// waits too, but can't report.
+class WriteBehindSink : public ByteSink {
+private:
+    std::unique_ptr<ByteSink> sink;
+    ByteChannel channel;
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+    std::thread thread;
+
+public:
+    WriteBehindSink(std::unique_ptr<ByteSink> sink, size_t depth = 2)
+    : sink(std::move(sink)), channel(depth) {
+        STATS_CONTEXT(stats_context);
+        thread = std::thread([this STATS_CAPTURE(stats_context)]() {
+            STATS_ADOPT(stats_context);
+            try {
+                std::vector<unsigned char> chunk;
+                while (channel.pop(chunk)) {
+                    STATS_PHASE(WRITE);
+                    this->sink->write(chunk.data(), chunk.size());
+                    if (!this->sink->good()) {
+                        throw std::runtime_error("write failed");
+                    }
+                }
+                this->sink->close();
+                if (!this->sink->good()) {
+                    throw std::runtime_error("write failed");
+                }
+            } catch (...) {
+                error = std::current_exception();
+                failed = true;
+                channel.cancel();
+            }
+        });
+    }
+
+    WriteBehindSink(const WriteBehindSink&) = delete;
+    WriteBehindSink& operator=(const WriteBehindSink&) = delete;
+
+    ~WriteBehindSink() {
+        channel.close();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    void write(const unsigned char* data, size_t size) override {
+        if (failed) {
+            std::rethrow_exception(error);
+        }
+        channel.push(std::vector<unsigned char>(data, data + size));
+    }
+
+    bool good() const override {
+        return !failed;
+    }
+
+    void close() override {
+        channel.close();
+        if (thread.joinable()) {
+            thread.join();
+        }
+        if (failed) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+
+// Runs two coding stages back to back without an intermediate file: the
+// first stage runs on its own thread and feeds the second through a
+// bounded ByteChannel, so memory stays at `depth` BitStream buffers no
+// matter how large the intermediate stream is.
+class Pipeline {
+public:
+    using Stage = std::function<void(BitStream&, BitStream&)>;
+
+private:
+    Stage first;
+    Stage second;
+    size_t depth;
+
+public:
+    Pipeline(Stage first, Stage second, size_t depth = 4)
+    : first(std::move(first)), second(std::move(second)), depth(depth) {}
+
+    void Run(BitStream& fi, BitStream& fo) {
+        ByteChannel channel(depth);
+        std::exception_ptr first_error;
+
+        STATS_CONTEXT(stats_context);
+        std::thread producer([&]() {
+            STATS_ADOPT(stats_context);
+            try {
+                BitStream to(std::make_unique<ChannelSink>(channel));
+                first(fi, to);
+            } catch (...) {
+                first_error = std::current_exception();
+                channel.close();
+            }
+        });
+
+        try {
+            BitStream from(std::make_unique<ChannelSource>(channel));
+            second(from, fo);
+        } catch (...) {
+            channel.cancel();
+            producer.join();
+            // the first stage failing is the root cause of whatever the
+            // second one ran into
+            if (first_error) {
+                std::rethrow_exception(first_error);
+            }
+            throw;
+        }
+        // the second stage may stop before the end of its input
+        channel.cancel();
+        producer.join();
+        if (first_error) {
+            std::rethrow_exception(first_error);
+        }
+    }
+};
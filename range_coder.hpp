@@ -0,0 +1,160 @@
+#pragma once
+
+#include "bitstream.hpp"
+#include "frequency_model.hpp"
+#include "static_model.hpp"
+
+#include "cstdint"
+#include "string"
+
+
+// Carry-less byte-oriented range coder (Subbotin). Shares the frequency
+// models with BAC, but keeps a 32-bit low/range pair and
+// renormalizes a whole byte at a time, so the coder touches the streams
+// once per output byte instead of once per bit.
+class RangeCoder {
+private:
+    static constexpr int BYTE_SIZE = 8;
+    static constexpr int EOF_CODE = 256;
+    static constexpr int STATE_BYTES = 4;
+
+    static constexpr uint32_t TOP = uint32_t(1) << 24;
+    static constexpr uint32_t BOT = uint32_t(1) << 16; // > max model count
+
+    int order;
+    FrequencyModel model;
+
+    // True while the top byte of low is not settled yet. When the range
+    // underflows without settling, it is cut down to the next BOT boundary
+    // so that no carry can ever reach bytes already written.
+    static bool needsShift(uint32_t low, uint32_t& range) {
+        if ((low ^ (low + range)) < TOP) {
+            return true;
+        }
+        if (range < BOT) {
+            range = -low & (BOT - 1);
+            return true;
+        }
+        return false;
+    }
+
+    template <class M>
+    void Encode(M& model, BitStream& fi, BitStream& fo) {
+        uint32_t low = 0;
+        uint32_t range = 0xFFFFFFFF;
+
+        int c = 0;
+        while (true) {
+            c = fi.getByte();
+            if (c == std::istream::traits_type::eof()) {
+                c = EOF_CODE;
+            }
+
+            Probability prob = model.getProbability(c);
+            range /= prob.count;
+            low += prob.low * range;
+            range *= prob.high - prob.low;
+
+            while (needsShift(low, range)) {
+                fo.writeBits(low >> 24, BYTE_SIZE);
+                low <<= BYTE_SIZE;
+                range <<= BYTE_SIZE;
+            }
+
+            if (c == EOF_CODE) {
+                break;
+            }
+        }
+
+        for (int i = 0; i < STATE_BYTES; ++i) {
+            fo.writeBits(low >> 24, BYTE_SIZE);
+            low <<= BYTE_SIZE;
+        }
+    }
+
+    template <class M>
+    void Decode(M& model, BitStream& fi, BitStream& fo) {
+        uint32_t low = 0;
+        uint32_t range = 0xFFFFFFFF;
+        uint32_t code = 0;
+
+        // bytes past the end of the stream read as zeros
+        auto next = [&fi]() -> uint32_t {
+            int b = fi.getByte();
+            return b == std::istream::traits_type::eof() ? 0 : b;
+        };
+
+        for (int i = 0; i < STATE_BYTES; ++i) {
+            code = (code << BYTE_SIZE) | next();
+        }
+
+        while (true) {
+            range /= model.getCount();
+            uint32_t scaled_val = (code - low) / range;
+            if (scaled_val >= model.getCount()) {
+                throw std::runtime_error("RangeCoder: corrupted input");
+            }
+
+            int c;
+            Probability prob = model.getChar(scaled_val, c);
+            if (c == EOF_CODE) {
+                break;
+            }
+            fo.writeBits(c, BYTE_SIZE);
+
+            low += prob.low * range;
+            range *= prob.high - prob.low;
+
+            while (needsShift(low, range)) {
+                code = (code << BYTE_SIZE) | next();
+                low <<= BYTE_SIZE;
+                range <<= BYTE_SIZE;
+            }
+        }
+    }
+
+public:
+    static constexpr int LEGACY_ORDER = -1;
+    static constexpr int STATIC_ORDER = -2;
+
+    // same model choice as BAC: LEGACY_ORDER, STATIC_ORDER or a ContextModel order
+    RangeCoder(int order = LEGACY_ORDER) : order(order) {}
+
+    void Compress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Compress(fi, fo);
+    }
+
+    void Compress(BitStream& fi, BitStream& fo) {
+        if (order == LEGACY_ORDER) {
+            model.reset();
+            Encode(model, fi, fo);
+        } else if (order == STATIC_ORDER) {
+            StaticModel::TwoPass(fi, fo, [this, &fo](StaticModel& m, BitStream& in) { Encode(m, in, fo); });
+        } else {
+            ContextModel context_model(order);
+            Encode(context_model, fi, fo);
+        }
+    }
+
+    void Decompress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Decompress(fi, fo);
+    }
+
+    void Decompress(BitStream& fi, BitStream& fo) {
+        if (order == LEGACY_ORDER) {
+            model.reset();
+            Decode(model, fi, fo);
+        } else if (order == STATIC_ORDER) {
+            StaticModel static_model;
+            static_model.read(fi);
+            Decode(static_model, fi, fo);
+        } else {
+            ContextModel context_model(order);
+            Decode(context_model, fi, fo);
+        }
+    }
+};
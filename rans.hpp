@@ -0,0 +1,230 @@
+#pragma once
+
+#include "bitstream.hpp"
+#include "static_model.hpp"
+
+#include "cstdint"
+#include "stdexcept"
+#include "string"
+#include "vector"
+
+
+// Static order-0 rANS coder with LANES interleaved states. The input is
+// coded in chunks, each with its own quantized frequency table:
+//
+//   raw size(32) | frequency table | LANES x lane size(32) | lane bytes
+//
+// and a raw size of 0 ends the stream. Symbol i is coded by lane
+// i % LANES, and every lane writes its own word stream, so the decode
+// chains of the lanes share nothing and the CPU overlaps them. States are
+// 32 bits and are renormalized 16 bits at a time, so a symbol needs at
+// most one refill, done without a branch.
+class RANS {
+private:
+    static constexpr int LANES = 4;
+    static constexpr int SCALE_BITS = 12;
+    static constexpr uint32_t TOTAL = uint32_t(1) << SCALE_BITS;
+    static constexpr uint32_t LOW = uint32_t(1) << 16; // states live in [LOW, 2^32)
+    static constexpr int WORD_BITS = 16;
+    static constexpr size_t CHUNK_SIZE = size_t(1) << 20;
+    static constexpr size_t READ_PADDING = 2;
+
+    // decoder lookup table entry of one of the TOTAL slots
+    struct Slot {
+        uint16_t freq;
+        uint16_t bias; // slot - cumulative frequency of the symbol
+    };
+
+    uint32_t freq[256];
+    uint32_t cum[256];
+    std::vector<Slot> slots;
+    std::vector<unsigned char> symbols; // slot -> symbol
+    std::vector<unsigned char> raw;
+    std::vector<unsigned char> packed;
+    size_t lane_start[LANES];
+    size_t lane_end[LANES];
+
+    void buildCumulative() {
+        uint32_t sum = 0;
+        for (int c = 0; c < 256; ++c) {
+            cum[c] = sum;
+            sum += freq[c];
+        }
+    }
+
+    void buildSlots() {
+        slots.resize(TOTAL);
+        symbols.resize(TOTAL);
+        for (int c = 0; c < 256; ++c) {
+            for (uint32_t i = 0; i < freq[c]; ++i) {
+                slots[cum[c] + i] = Slot{uint16_t(freq[c]), uint16_t(i)};
+                symbols[cum[c] + i] = static_cast<unsigned char>(c);
+            }
+        }
+    }
+
+    // Codes raw[0, n) backwards; lane l gets symbols l, l + LANES, ... and
+    // its words end up in packed[lane_start[l], lane_end[l]).
+    void encodeChunk(size_t n) {
+        // at most one word per symbol plus the final state
+        size_t lane_capacity = 2 * (n / LANES + 1) + 4;
+        packed.resize(LANES * lane_capacity);
+
+        uint32_t state[LANES];
+        unsigned char* ptr[LANES];
+        for (int lane = 0; lane < LANES; ++lane) {
+            state[lane] = LOW;
+            lane_end[lane] = (lane + 1) * lane_capacity;
+            ptr[lane] = packed.data() + lane_end[lane];
+        }
+        for (size_t i = n; i-- > 0;) {
+            uint32_t& x = state[i % LANES];
+            unsigned char*& p = ptr[i % LANES];
+            int c = raw[i];
+            // keeps the coded state below 2^32
+            uint64_t x_max = uint64_t((LOW >> SCALE_BITS) << WORD_BITS) * freq[c];
+            if (x >= x_max) {
+                p -= 2;
+                p[0] = static_cast<unsigned char>(x);
+                p[1] = static_cast<unsigned char>(x >> 8);
+                x >>= WORD_BITS;
+            }
+            x = ((x / freq[c]) << SCALE_BITS) + (x % freq[c]) + cum[c];
+        }
+        for (int lane = 0; lane < LANES; ++lane) {
+            ptr[lane] -= 4;
+            for (int b = 0; b < 4; ++b) {
+                ptr[lane][b] = static_cast<unsigned char>(state[lane] >> (8 * b));
+            }
+            lane_start[lane] = ptr[lane] - packed.data();
+        }
+    }
+
+    // Decodes n bytes from the lane streams packed[lane_start, lane_end)
+    // into out. The refill is branchless and may read one word past a
+    // lane's end, so packed carries READ_PADDING spare bytes; a lane that
+    // refills past its end is corrupt and stops before the next read.
+    void decodeChunk(unsigned char* out, size_t n) const {
+        uint32_t state[LANES];
+        const unsigned char* ptr[LANES];
+        const unsigned char* end[LANES];
+        for (int lane = 0; lane < LANES; ++lane) {
+            const unsigned char* p = packed.data() + lane_start[lane];
+            state[lane] = uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+            ptr[lane] = p + 4;
+            end[lane] = packed.data() + lane_end[lane];
+        }
+        auto overrun = [&ptr, &end]() {
+            bool past = false;
+            for (int lane = 0; lane < LANES; ++lane) {
+                past |= ptr[lane] > end[lane];
+            }
+            return past;
+        };
+
+        const Slot* table = slots.data();
+        const unsigned char* symbol_of = symbols.data();
+        auto step = [table, symbol_of](uint32_t& x, const unsigned char*& p) -> unsigned char {
+            uint32_t slot = x & (TOTAL - 1);
+            unsigned char c = symbol_of[slot];
+            x = table[slot].freq * (x >> SCALE_BITS) + table[slot].bias;
+            // arithmetic rather than ?: so the compiler can't turn the
+            // unpredictable refill back into a branch
+            uint32_t refill = x < LOW;
+            uint32_t word = p[0] | uint32_t(p[1]) << 8;
+            x = (x << (refill * WORD_BITS)) | (word & -refill);
+            p += refill * 2;
+            return c;
+        };
+
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            for (int lane = 0; lane < LANES; ++lane) {
+                out[i + lane] = step(state[lane], ptr[lane]);
+            }
+            if (overrun()) {
+                throw std::runtime_error("RANS: corrupted input");
+            }
+        }
+        for (int lane = 0; i < n; ++i, ++lane) {
+            out[i] = step(state[lane], ptr[lane]);
+        }
+        for (int lane = 0; lane < LANES; ++lane) {
+            if (ptr[lane] != end[lane]) {
+                throw std::runtime_error("RANS: corrupted input");
+            }
+        }
+    }
+
+public:
+    void Compress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Compress(fi, fo);
+    }
+
+    void Compress(BitStream& fi, BitStream& fo) {
+        raw.resize(CHUNK_SIZE);
+        while (size_t n = fi.readBytes(raw.data(), raw.size())) {
+            uint64_t hist[256] = {};
+            Histogram(raw.data(), n, hist);
+            QuantizeFrequencies(hist, TOTAL, freq);
+            buildCumulative();
+            encodeChunk(n);
+
+            fo.writeBits(n, 32);
+            WriteFrequencies(fo, freq, SCALE_BITS);
+            for (int lane = 0; lane < LANES; ++lane) {
+                fo.writeBits(lane_end[lane] - lane_start[lane], 32);
+            }
+            for (int lane = 0; lane < LANES; ++lane) {
+                fo.writeBytes(packed.data() + lane_start[lane], lane_end[lane] - lane_start[lane]);
+            }
+        }
+        fo.writeBits(0, 32);
+    }
+
+    void Decompress(std::string in, std::string out) {
+        BitStream fi(in, "r");
+        BitStream fo(out,"w");
+        Decompress(fi, fo);
+    }
+
+    void Decompress(BitStream& fi, BitStream& fo) {
+        try {
+            while (true) {
+                size_t n = fi.readBits(32);
+                if (n == 0) {
+                    break;
+                }
+                if (n > CHUNK_SIZE) {
+                    throw std::runtime_error("RANS: corrupted input");
+                }
+                if (ReadFrequencies(fi, freq, SCALE_BITS) != TOTAL) {
+                    throw std::runtime_error("RANS: corrupted frequency table");
+                }
+                buildCumulative();
+                buildSlots();
+
+                size_t size = 0;
+                for (int lane = 0; lane < LANES; ++lane) {
+                    size_t lane_size = fi.readBits(32);
+                    // a lane holds at least its final state, and whole words
+                    if (lane_size < 4 || lane_size % 2 != 0) {
+                        throw std::runtime_error("RANS: corrupted input");
+                    }
+                    lane_start[lane] = size;
+                    size += lane_size;
+                    lane_end[lane] = size;
+                }
+                packed.resize(size + READ_PADDING);
+                if (fi.readBytes(packed.data(), size) != size) {
+                    throw std::runtime_error("RANS: truncated input");
+                }
+                decodeChunk(fo.reserveBytes(n), n);
+            }
+        } catch (EOFReachedException& ex) {
+            throw std::runtime_error("RANS: truncated input");
+        }
+    }
+};
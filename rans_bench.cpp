@@ -0,0 +1,75 @@
+// Decode throughput of the interleaved rANS coder against BAC::Decompress,
+// with the adaptive and the static BAC model.
+// Build: g++ -std=c++20 -O2 -pthread rans_bench.cpp -o rans_bench
+#include "bac.hpp"
+#include "rans.hpp"
+
+#include "chrono"
+#include "functional"
+#include "iomanip"
+#include "iostream"
+#include "random"
+#include "vector"
+
+
+using Codec = std::function<void(BitStream&, BitStream&)>;
+
+std::vector<unsigned char> code(const Codec& codec, const std::vector<unsigned char>& in) {
+    std::vector<unsigned char> out;
+    {
+        BitStream fi(std::make_unique<MemorySource>(in.data(), in.size()));
+        BitStream fo(std::make_unique<VectorSink>(out));
+        codec(fi, fo);
+    }
+    return out;
+}
+
+void run(const char* name, const Codec& compress, const Codec& decompress,
+         const std::vector<unsigned char>& input) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<unsigned char> packed = code(compress, input);
+    auto mid = std::chrono::high_resolution_clock::now();
+    std::vector<unsigned char> unpacked = code(decompress, packed);
+    auto end = std::chrono::high_resolution_clock::now();
+    if (unpacked != input) {
+        throw std::logic_error("rans_bench: round trip failed");
+    }
+
+    std::chrono::duration<double> enc = mid - start;
+    std::chrono::duration<double> dec = end - mid;
+    double mb = double(input.size()) / (1 << 20);
+    std::cout << std::setw(12) << name
+              << std::setw(10) << double(input.size()) / packed.size()
+              << std::setw(16) << mb / enc.count()
+              << std::setw(16) << mb / dec.count() << '\n';
+}
+
+int main()
+{
+    const size_t count = size_t(1) << 25;
+    std::mt19937 rng(42);
+
+    std::vector<unsigned char> uniform(count), skewed(count);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::geometric_distribution<int> geo(0.05);
+    for (size_t i = 0; i < count; ++i) {
+        uniform[i] = static_cast<unsigned char>(byte(rng));
+        skewed[i] = static_cast<unsigned char>('a' + std::min(geo(rng), 150));
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto& [title, input] : {std::pair{"uniform", &uniform}, std::pair{"skewed", &skewed}}) {
+        std::cout << title << '\n' << std::setw(12) << "coder" << std::setw(10) << "ratio"
+                  << std::setw(16) << "encode MB/s" << std::setw(16) << "decode MB/s" << '\n';
+        run("bac",
+            [](BitStream& fi, BitStream& fo) { BAC().Compress(fi, fo); },
+            [](BitStream& fi, BitStream& fo) { BAC().Decompress(fi, fo); }, *input);
+        run("bac-static",
+            [](BitStream& fi, BitStream& fo) { BAC(BAC::STATIC_ORDER).Compress(fi, fo); },
+            [](BitStream& fi, BitStream& fo) { BAC(BAC::STATIC_ORDER).Decompress(fi, fo); }, *input);
+        run("rans",
+            [](BitStream& fi, BitStream& fo) { RANS().Compress(fi, fo); },
+            [](BitStream& fi, BitStream& fo) { RANS().Decompress(fi, fo); }, *input);
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+// Round-trip tests of every codec over a fixed set of inputs. With a group
+// name as the argument only that group runs, which is how ctest runs them.
+// Build: g++ -std=c++20 -O2 -pthread roundtrip_test.cpp -o roundtrip_test
+#include "codec_api.hpp"
+#include "lzw.hpp"
+#include "bac.hpp"
+#include "range_coder.hpp"
+#include "rans.hpp"
+#include "lzss.hpp"
+#include "auto_codec.hpp"
+#include "block_codec.hpp"
+#include "static_model.hpp"
+#include "dedup.hpp"
+
+#include "algorithm"
+#include "cstring"
+#include "iomanip"
+#include "iostream"
+#include "random"
+#include "sstream"
+#include "string"
+#include "utility"
+#include "vector"
+
+
+using Bytes = std::vector<std::byte>;
+
+struct Input {
+    std::string name;
+    Bytes data;
+};
+
+std::vector<Input> MakeInputs() {
+    std::mt19937 rng(42);
+    std::vector<Input> inputs;
+    auto add = [&inputs](std::string name, size_t size) -> Bytes& {
+        inputs.push_back({std::move(name), Bytes(size)});
+        return inputs.back().data;
+    };
+
+    add("empty", 0);
+    add("single", 1)[0] = std::byte{'x'};
+    add("zeros", 200000);
+
+    for (std::byte& b : add("random", 200000)) {
+        b = std::byte(rng());
+    }
+
+    std::geometric_distribution<int> geo(0.05);
+    for (std::byte& b : add("skewed", 200000)) {
+        b = std::byte('a' + std::min(geo(rng), 150));
+    }
+
+    const char* words[] = {"the ", "archive ", "codec ", "block ", "of ", "stream ", "bits\n", "and "};
+    Bytes& text = add("text", 0);
+    while (text.size() < 400000) {
+        for (const char* p = words[rng() % 8]; *p; ++p) {
+            text.push_back(std::byte(*p));
+        }
+    }
+
+    // repeats further apart than the LZSS window and the BitStream buffer
+    Bytes piece(150000);
+    for (std::byte& b : piece) {
+        b = std::byte(rng() % 16);
+    }
+    Bytes& far = add("far-repeats", 0);
+    for (int i = 0; i < 3; ++i) {
+        far.insert(far.end(), piece.begin(), piece.end());
+    }
+    return inputs;
+}
+
+Bytes Decode(const Codec& codec, const Bytes& packed) {
+    return Encode(codec, packed);
+}
+
+// A codec given as its two directions.
+struct Case {
+    std::string group;
+    std::string name;
+    Codec compress;
+    Codec decompress;
+};
+
+std::vector<Case> MakeCases() {
+    std::vector<Case> cases;
+    auto add = [&cases](std::string group, std::string name, Codec compress, Codec decompress) {
+        cases.push_back({std::move(group), std::move(name), std::move(compress), std::move(decompress)});
+    };
+
+    for (int bits : {LZW::MIN_BITS, 12, LZW::DEFAULT_MAX_BITS, LZW::MAX_BITS}) {
+        add("lzw", "lzw-" + std::to_string(bits), CompressorOf<LZW>(bits), DecompressorOf<LZW>());
+    }
+
+    for (int order : {BAC::LEGACY_ORDER, 0, 1, 2, BAC::STATIC_ORDER}) {
+        std::string suffix = "-o" + std::to_string(order);
+        add("bac", "bac" + suffix, CompressorOf<BAC>(order), DecompressorOf<BAC>(order));
+        add("bac32", "bac32" + suffix, CompressorOf<BAC32>(order), DecompressorOf<BAC32>(order));
+        add("range", "range" + suffix, CompressorOf<RangeCoder>(order), DecompressorOf<RangeCoder>(order));
+    }
+
+    add("rans", "rans", CompressorOf<RANS>(), DecompressorOf<RANS>());
+
+    add("lzw-bac", "lzw+bac",
+        [](BitStream& fi, BitStream& fo) {
+            Pipeline(CompressorOf<LZW>(), CompressorOf<BAC>()).Run(fi, fo);
+        },
+        [](BitStream& fi, BitStream& fo) {
+            Pipeline(DecompressorOf<BAC>(), DecompressorOf<LZW>()).Run(fi, fo);
+        });
+
+    for (int level = LZSS::MIN_LEVEL; level <= LZSS::MAX_LEVEL; ++level) {
+        add("lzss", "lzss-" + std::to_string(level), CompressorOf<LZSS>(level), DecompressorOf<LZSS>());
+    }
+    add("lzss", "lzss+bac",
+        [](BitStream& fi, BitStream& fo) {
+            Pipeline(CompressorOf<LZSS>(), CompressorOf<BAC>()).Run(fi, fo);
+        },
+        [](BitStream& fi, BitStream& fo) {
+            Pipeline(DecompressorOf<BAC>(), DecompressorOf<LZSS>()).Run(fi, fo);
+        });
+
+    add("auto", "auto", CompressorOf<AutoCodec>(), DecompressorOf<AutoCodec>());
+    add("auto", "auto-bac32",
+        CompressorOf<AutoCodec>(BAC::LEGACY_ORDER, LZW::DEFAULT_MAX_BITS, BAC32::CODE_BITS),
+        DecompressorOf<AutoCodec>(BAC::LEGACY_ORDER, LZW::DEFAULT_MAX_BITS, BAC32::CODE_BITS));
+
+    // small blocks, so every input but the tiny ones spans several
+    for (auto& [name, compress, decompress] : {
+             std::tuple{"lzw", CompressorOf<LZW>(), DecompressorOf<LZW>()},
+             std::tuple{"bac", CompressorOf<BAC>(), DecompressorOf<BAC>()},
+             std::tuple{"auto", CompressorOf<AutoCodec>(), DecompressorOf<AutoCodec>()}}) {
+        add("block", std::string("block-") + name,
+            [compress](BitStream& fi, BitStream& fo) { BlockCodec(65536, 2).Compress(fi, fo, compress); },
+            [decompress](BitStream& fi, BitStream& fo) { BlockCodec(65536, 2).Decompress(fi, fo, decompress); });
+    }
+    return cases;
+}
+
+// Decodes one raw range through the block index and checks it against the
+// input.
+bool CheckRanges(const Input& input) {
+    Codec lzw = CompressorOf<LZW>();
+    Codec unlzw = DecompressorOf<LZW>();
+    Bytes packed = Encode([&lzw](BitStream& fi, BitStream& fo) {
+        BlockCodec(65536, 2).Compress(fi, fo, lzw);
+    }, input.data);
+    std::string stream(reinterpret_cast<const char*>(packed.data()), packed.size());
+    std::istringstream in(stream);
+
+    const std::pair<uint64_t, uint64_t> ranges[] = {
+        {0, 10}, {65530, 20}, {100000, 200000}, {input.data.size() / 2, uint64_t(-1)}, {input.data.size(), 5}};
+    for (auto [offset, length] : ranges) {
+        Bytes out;
+        {
+            BitStream fo(std::make_unique<ByteVectorSink>(out));
+            BlockCodec(65536, 2).DecompressRange(in, 0, stream.size(), offset, length, fo, unlzw);
+            fo.finish();
+        }
+        uint64_t from = std::min<uint64_t>(offset, input.data.size());
+        uint64_t to = std::min<uint64_t>(input.data.size(), length > uint64_t(-1) - offset ? uint64_t(-1) : offset + length);
+        if (out != Bytes(input.data.begin() + from, input.data.begin() + to)) {
+            std::cout << "FAIL block-range/" << input.name << ": range at " << offset << " differs\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Feeds the input to a StreamCoder in uneven pieces in both directions.
+bool CheckStream(const Input& input) {
+    auto run = [](const Codec& codec, const Bytes& in) {
+        Bytes out;
+        StreamCoder coder(codec);
+        for (size_t at = 0, piece = 1; at < in.size(); at += piece, piece = piece * 3 + 7) {
+            piece = std::min(piece, in.size() - at);
+            coder.push(std::span<const std::byte>(in.data() + at, piece), out);
+        }
+        coder.finish(out);
+        return out;
+    };
+    Bytes packed = run(CompressorOf<BAC>(1), input.data);
+    if (packed != Encode(CompressorOf<BAC>(1), input.data)) {
+        std::cout << "FAIL stream/" << input.name << ": differs from the one-shot encoding\n";
+        return false;
+    }
+    if (run(DecompressorOf<BAC>(1), packed) != input.data) {
+        std::cout << "FAIL stream/" << input.name << ": round trip differs\n";
+        return false;
+    }
+    return true;
+}
+
+// Histograms of inputs of 4 GiB and more: counts past 2^32, one of them a
+// multiple of it that a 32-bit counter would wrap to 0, and counts large
+// enough to overflow the scaling product.
+bool CheckQuantize() {
+    const uint64_t big = uint64_t(1) << 32;
+    uint64_t wrapping[256] = {};
+    wrapping[0] = big;
+    wrapping['a'] = big + 7;
+    wrapping[255] = 1;
+    uint64_t huge[256];
+    std::fill(huge, huge + 256, uint64_t(1) << 50);
+
+    for (const uint64_t* hist : {wrapping, huge}) {
+        StaticModel model;
+        model.quantize(hist);
+        uint32_t sum = 0;
+        for (int c = 0; c < 256; ++c) {
+            Probability p = model.getProbability(c);
+            if ((p.high > p.low) != (hist[c] != 0)) {
+                std::cout << "FAIL quantize: byte " << c << " got width " << p.high - p.low
+                          << " for count " << hist[c] << '\n';
+                return false;
+            }
+            sum += p.high - p.low;
+        }
+        Probability eof = model.getProbability(256);
+        if (eof.high - eof.low != 1 || sum + 1 != StaticModel::TOTAL) {
+            std::cout << "FAIL quantize: frequencies don't add up to the total\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// The dedup fingerprint against the FIPS 180-2 SHA-256 test vectors,
+// covering the one- and two-block padding cases and a long input.
+bool CheckFingerprint() {
+    const std::pair<std::string, const char*> vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    for (const auto& [message, expected] : vectors) {
+        Fingerprint f = Fingerprint::Of(reinterpret_cast<const unsigned char*>(message.data()), message.size());
+        std::ostringstream hex;
+        for (unsigned char b : f.digest) {
+            hex << std::hex << std::setw(2) << std::setfill('0') << int(b);
+        }
+        if (hex.str() != expected) {
+            std::cout << "FAIL fingerprint: " << message.size() << " bytes hashed to " << hex.str() << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char const *argv[])
+{
+    std::string only = argc > 1 ? argv[1] : "";
+    std::vector<Input> inputs = MakeInputs();
+    int failures = 0;
+    int passed = 0;
+
+    for (const Case& c : MakeCases()) {
+        if (!only.empty() && c.group != only) {
+            continue;
+        }
+        for (const Input& input : inputs) {
+            try {
+                Bytes packed = Encode(c.compress, input.data);
+                if (Decode(c.decompress, packed) != input.data) {
+                    std::cout << "FAIL " << c.name << '/' << input.name << ": round trip differs\n";
+                    ++failures;
+                    continue;
+                }
+                ++passed;
+            } catch (std::exception& ex) {
+                std::cout << "FAIL " << c.name << '/' << input.name << ": " << ex.what() << '\n';
+                ++failures;
+            }
+        }
+    }
+
+    for (const Input& input : inputs) {
+        using Check = std::pair<const char*, bool (*)(const Input&)>;
+        for (auto [group, check] : {Check{"block-range", CheckRanges}, Check{"stream", CheckStream}}) {
+            if (!only.empty() && only != group) {
+                continue;
+            }
+            try {
+                if (check(input)) {
+                    ++passed;
+                } else {
+                    ++failures;
+                }
+            } catch (std::exception& ex) {
+                std::cout << "FAIL " << group << '/' << input.name << ": " << ex.what() << '\n';
+                ++failures;
+            }
+        }
+    }
+
+    // incompressible data must be stored, not expanded by a coder
+    if (only.empty() || only == "auto") {
+        const Input& random = *std::find_if(inputs.begin(), inputs.end(),
+                                            [](const Input& i) { return i.name == "random"; });
+        AutoCodec::Method method = AutoCodec().Analyze(
+            reinterpret_cast<const unsigned char*>(random.data.data()), random.data.size());
+        if (method != AutoCodec::STORED) {
+            std::cout << "FAIL auto/random: chose method " << int(method) << " over storing\n";
+            ++failures;
+        } else {
+            ++passed;
+        }
+    }
+
+    using Single = std::pair<const char*, bool (*)()>;
+    for (auto [group, check] : {Single{"quantize", CheckQuantize}, Single{"fingerprint", CheckFingerprint}}) {
+        if (only.empty() || only == group) {
+            if (check()) {
+                ++passed;
+            } else {
+                ++failures;
+            }
+        }
+    }
+
+    std::cout << passed << " passed, " << failures << " failed\n";
+    if (passed == 0) {
+        std::cout << "no test group named " << only << '\n';
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
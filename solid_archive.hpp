@@ -0,0 +1,527 @@
+#pragma once
+
+#include "archive_format.hpp"
+#include "bitstream.hpp"
+#include "block_codec.hpp"
+#include "crc32c.hpp"
+#include "dedup.hpp"
+#include "thread_pool.hpp"
+
+#include "algorithm"
+#include "cstdint"
+#include "deque"
+#include "filesystem"
+#include "fstream"
+#include "functional"
+#include "future"
+#include "memory"
+#include "stdexcept"
+#include "string"
+#include "unordered_map"
+#include "vector"
+
+
+// Many files in one archive. The members are concatenated into one solid
+// stream, which is cut into groups of group_size bytes; each group is coded
+// as one codec stream, so small files share codec state. Layout:
+//
+//   header | packed group* | directory | directory offset(64) | magic(32)
+//
+//   directory: magic(32) | group size(64) | group count(32) | group* | member count(32) | member*
+//   group:     offset in the archive(64) | packed size(64) | raw size(64)
+//   member:    offset in the solid stream(64) | size(64) | CRC32C(32)
+//              | mtime(64) | mode(32) | name length(16) | name
+//
+// With ArchiveHeader::DEDUP_FLAG the members are cut into content-defined
+// chunks (see Chunker) and the solid stream holds each distinct chunk once,
+// so a file repeated or nearly repeated in the tree is coded only once.
+// A member is then the list of solid stream ranges it is made of:
+//
+//   member:    extent count(32) | extent* | size(64) | CRC32C(32)
+//              | mtime(64) | mode(32) | name length(16) | name
+//   extent:    offset in the solid stream(64) | size(64)
+//
+// Listing needs only the directory, found through the fixed-size footer;
+// extracting a member decodes just the groups its bytes fall into.
+class SolidArchive {
+public:
+    using Codec = BlockCodec::Codec;
+
+    // A range of the solid stream.
+    struct Extent {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    struct Member {
+        std::string name; // relative, '/'-separated
+        std::vector<Extent> extents; // the member's bytes, in order; none if empty
+        uint64_t size = 0;
+        uint32_t crc = 0;
+        int64_t mtime = 0; // std::filesystem::file_time_type ticks
+        uint32_t mode = 0; // std::filesystem::perms
+    };
+
+    struct Group {
+        uint64_t offset = 0;
+        uint64_t packed_size = 0;
+        uint64_t raw_size = 0;
+    };
+
+    // Opens the output for a member being extracted.
+    using OpenMember = std::function<std::unique_ptr<ByteSink>(const Member&)>;
+    // Called once a member is complete and its CRC checked.
+    using MemberDone = std::function<void(const Member&)>;
+
+private:
+    static constexpr uint32_t DIRECTORY_MAGIC = 0x53444952; // "SDIR"
+    static constexpr uint32_t FOOTER_MAGIC = 0x53454E44;    // "SEND"
+    static constexpr size_t FOOTER_SIZE = 12;
+    static constexpr int WORD_SIZE = 32;
+    static constexpr size_t READ_SIZE = 1 << 20; // bytes read at once when chunking
+
+    using Block = std::vector<unsigned char>;
+
+    std::string path;
+    ArchiveHeader header;
+    uint64_t group_size = 0;
+    std::vector<Group> groups;
+    std::vector<Member> members;
+    bool dedup = false;
+
+    static void writeWide(BitStream& fo, uint64_t v) {
+        fo.writeBits(static_cast<uint32_t>(v >> 32), WORD_SIZE);
+        fo.writeBits(static_cast<uint32_t>(v), WORD_SIZE);
+    }
+
+    static uint64_t readWide(BitStream& fi) {
+        uint64_t hi = fi.readBits(WORD_SIZE);
+        return hi << 32 | fi.readBits(WORD_SIZE);
+    }
+
+    static std::future<Block> run(ThreadPool& pool, const Codec& codec,
+                                  std::shared_ptr<Block> in, size_t expected_size) {
+        return pool.submit([&codec, in, expected_size]() {
+            Block out;
+            out.reserve(expected_size);
+            {
+                BitStream bi(std::make_unique<MemorySource>(in->data(), in->size()));
+                BitStream bo(std::make_unique<VectorSink>(out));
+                codec(bi, bo);
+            }
+            return out;
+        });
+    }
+
+    // Decodes the groups in `sequence` in order on a pool and hands each to
+    // consume(index, bytes).
+    template <class F>
+    void forEachGroup(const std::vector<size_t>& sequence, const Codec& codec, unsigned threads,
+                      F consume) const {
+        std::ifstream f(path, std::ios::in | std::ios::binary);
+        ThreadPool pool(threads);
+        std::deque<std::pair<size_t, std::future<Block>>> inflight;
+
+        auto finishGroup = [&]() {
+            size_t g = inflight.front().first;
+            Block raw = inflight.front().second.get();
+            inflight.pop_front();
+            if (raw.size() != groups[g].raw_size) {
+                throw IntegrityError{"group decoded to a wrong size"};
+            }
+            consume(g, raw);
+        };
+
+        for (size_t g : sequence) {
+            auto packed = std::make_shared<Block>(groups[g].packed_size);
+            f.seekg(groups[g].offset);
+            f.read(reinterpret_cast<char*>(packed->data()), packed->size());
+            if (size_t(f.gcount()) != packed->size()) {
+                throw IntegrityError{"truncated archive"};
+            }
+            inflight.emplace_back(g, run(pool, codec, packed, groups[g].raw_size));
+            if (inflight.size() >= pool.size() * 2) {
+                finishGroup();
+            }
+        }
+        while (!inflight.empty()) {
+            finishGroup();
+        }
+    }
+
+    // Appends a range of the solid stream to a member, merging it with the
+    // last extent when they are adjacent.
+    static void addExtent(Member& m, uint64_t offset, uint64_t size) {
+        if (!m.extents.empty() && m.extents.back().offset + m.extents.back().size == offset) {
+            m.extents.back().size += size;
+        } else {
+            m.extents.push_back(Extent{offset, size});
+        }
+    }
+
+    static bool safeName(const std::string& name) {
+        std::filesystem::path p(name);
+        if (name.empty() || p.is_absolute() || p.has_root_name()) {
+            return false;
+        }
+        for (const auto& part : p) {
+            if (part == "..") {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // Packs `files`, stored under their paths relative to `root`; with
+    // DEDUP_FLAG in the header, repeated chunks are stored once.
+    static void Create(BitStream& fo, const ArchiveHeader& header, const std::string& root,
+                       const std::vector<std::string>& files, const Codec& codec,
+                       size_t group_size, unsigned threads) {
+        if (group_size == 0) {
+            throw std::invalid_argument("SolidArchive: group size must be positive");
+        }
+        bool dedup = header.flags & ArchiveHeader::DEDUP_FLAG;
+        header.write(fo);
+        uint64_t written = ArchiveHeader::SIZE;
+
+        ThreadPool pool(threads);
+        std::deque<std::pair<size_t, std::future<Block>>> inflight;
+        std::vector<Group> groups;
+        std::vector<Member> members;
+
+        auto writeGroup = [&]() {
+            Block packed = inflight.front().second.get();
+            groups.push_back(Group{written, packed.size(), inflight.front().first});
+            fo.writeBytes(packed.data(), packed.size());
+            written += packed.size();
+            inflight.pop_front();
+        };
+
+        auto group = std::make_shared<Block>();
+        group->reserve(group_size);
+        auto closeGroup = [&]() {
+            size_t n = group->size();
+            inflight.emplace_back(n, run(pool, codec, group, n));
+            if (inflight.size() >= pool.size() * 2) {
+                writeGroup();
+            }
+            group = std::make_shared<Block>();
+            group->reserve(group_size);
+        };
+
+        auto append = [&](const unsigned char* data, size_t n) {
+            while (n > 0) {
+                size_t k = std::min(n, group_size - group->size());
+                group->insert(group->end(), data, data + k);
+                data += k;
+                n -= k;
+                if (group->size() == group_size) {
+                    closeGroup();
+                }
+            }
+        };
+
+        // offset of the first copy of every chunk in the solid stream
+        std::unordered_map<Fingerprint, uint64_t, Fingerprint::Hash> chunks;
+        Block pending;
+
+        uint64_t stream_size = 0;
+        for (const std::string& file : files) {
+            Member m;
+            m.name = std::filesystem::relative(file, root).generic_string();
+            m.mtime = std::filesystem::last_write_time(file).time_since_epoch().count();
+            m.mode = static_cast<uint32_t>(std::filesystem::status(file).permissions());
+
+            CRC32C crc;
+            BitStream fi(file, "r");
+            if (dedup) {
+                size_t at = 0;
+                bool eof = false;
+                while (true) {
+                    if (!eof && pending.size() - at < Chunker::MAX_SIZE) {
+                        pending.erase(pending.begin(), pending.begin() + at);
+                        at = 0;
+                        size_t fill = pending.size();
+                        pending.resize(fill + READ_SIZE);
+                        size_t n = fi.readBytes(pending.data() + fill, READ_SIZE);
+                        pending.resize(fill + n);
+                        eof = n < READ_SIZE;
+                    }
+                    if (at == pending.size()) {
+                        break;
+                    }
+                    const unsigned char* chunk = pending.data() + at;
+                    size_t n = Chunker::Cut(chunk, pending.size() - at);
+                    crc.update(chunk, n);
+                    m.size += n;
+                    auto [it, fresh] = chunks.try_emplace(Fingerprint::Of(chunk, n), stream_size);
+                    if (fresh) {
+                        append(chunk, n);
+                        stream_size += n;
+                    }
+                    addExtent(m, it->second, n);
+                    at += n;
+                }
+                pending.clear();
+            } else {
+                while (true) {
+                    size_t fill = group->size();
+                    group->resize(group_size);
+                    size_t n = fi.readBytes(group->data() + fill, group_size - fill);
+                    group->resize(fill + n);
+                    crc.update(group->data() + fill, n);
+                    m.size += n;
+                    if (group->size() < group_size) {
+                        break;
+                    }
+                    closeGroup();
+                }
+                if (m.size > 0) {
+                    m.extents.push_back(Extent{stream_size, m.size});
+                }
+                stream_size += m.size;
+            }
+            m.crc = crc.value();
+            members.push_back(std::move(m));
+        }
+        if (!group->empty()) {
+            closeGroup();
+        }
+        while (!inflight.empty()) {
+            writeGroup();
+        }
+
+        uint64_t directory = written;
+        fo.writeBits(DIRECTORY_MAGIC, WORD_SIZE);
+        writeWide(fo, group_size);
+        fo.writeBits(groups.size(), WORD_SIZE);
+        for (const Group& g : groups) {
+            writeWide(fo, g.offset);
+            writeWide(fo, g.packed_size);
+            writeWide(fo, g.raw_size);
+        }
+        fo.writeBits(members.size(), WORD_SIZE);
+        uint64_t offset = 0;
+        for (const Member& m : members) {
+            if (dedup) {
+                fo.writeBits(m.extents.size(), WORD_SIZE);
+                for (const Extent& e : m.extents) {
+                    writeWide(fo, e.offset);
+                    writeWide(fo, e.size);
+                }
+            } else {
+                writeWide(fo, offset);
+                offset += m.size;
+            }
+            writeWide(fo, m.size);
+            fo.writeBits(m.crc, WORD_SIZE);
+            writeWide(fo, static_cast<uint64_t>(m.mtime));
+            fo.writeBits(m.mode, WORD_SIZE);
+            fo.writeBits(m.name.size(), 16);
+            fo.writeBytes(reinterpret_cast<const unsigned char*>(m.name.data()), m.name.size());
+        }
+        writeWide(fo, directory);
+        fo.writeBits(FOOTER_MAGIC, WORD_SIZE);
+    }
+
+    // Reads the directory of an archive; the groups are left on disk.
+    explicit SolidArchive(const std::string& path) : path(path) {
+        std::ifstream f(path, std::ios::in | std::ios::binary | std::ios::ate);
+        std::streamoff file_size = f.tellg();
+        if (!f || file_size < std::streamoff(ArchiveHeader::SIZE + FOOTER_SIZE)) {
+            throw IntegrityError{"truncated archive"};
+        }
+        auto readAt = [&f](std::streamoff pos, size_t n) {
+            Block bytes(n);
+            f.seekg(pos);
+            f.read(reinterpret_cast<char*>(bytes.data()), n);
+            if (size_t(f.gcount()) != n) {
+                throw IntegrityError{"truncated archive"};
+            }
+            return bytes;
+        };
+
+        try {
+            Block head = readAt(0, ArchiveHeader::SIZE);
+            BitStream hs(std::make_unique<MemorySource>(head.data(), head.size()));
+            header = ArchiveHeader::read(hs);
+            if (!(header.flags & ArchiveHeader::SOLID_FLAG)) {
+                throw IntegrityError{"not a solid archive"};
+            }
+            dedup = header.flags & ArchiveHeader::DEDUP_FLAG;
+
+            Block footer = readAt(file_size - FOOTER_SIZE, FOOTER_SIZE);
+            BitStream tail(std::make_unique<MemorySource>(footer.data(), footer.size()));
+            uint64_t directory = readWide(tail);
+            if (tail.readBits(WORD_SIZE) != FOOTER_MAGIC
+                || directory < ArchiveHeader::SIZE || directory > uint64_t(file_size) - FOOTER_SIZE) {
+                throw IntegrityError{"bad archive footer"};
+            }
+
+            Block bytes = readAt(directory, file_size - FOOTER_SIZE - directory);
+            BitStream fi(std::make_unique<MemorySource>(bytes.data(), bytes.size()));
+            if (fi.readBits(WORD_SIZE) != DIRECTORY_MAGIC) {
+                throw IntegrityError{"bad archive directory"};
+            }
+            group_size = readWide(fi);
+            groups.resize(fi.readBits(WORD_SIZE));
+            for (Group& g : groups) {
+                g.offset = readWide(fi);
+                g.packed_size = readWide(fi);
+                g.raw_size = readWide(fi);
+                if (g.offset + g.packed_size > directory || g.raw_size > group_size) {
+                    throw IntegrityError{"bad archive directory"};
+                }
+            }
+            members.resize(fi.readBits(WORD_SIZE));
+            uint64_t stream_size = groups.size() * group_size;
+            auto inStream = [stream_size](uint64_t offset, uint64_t size) {
+                return size <= stream_size && offset <= stream_size - size;
+            };
+            for (Member& m : members) {
+                uint64_t offset = 0;
+                if (dedup) {
+                    size_t count = fi.readBits(WORD_SIZE);
+                    if (count > bytes.size() / 16) {
+                        throw IntegrityError{"bad archive directory"};
+                    }
+                    m.extents.resize(count);
+                    for (Extent& e : m.extents) {
+                        e.offset = readWide(fi);
+                        e.size = readWide(fi);
+                        if (e.size == 0 || !inStream(e.offset, e.size)) {
+                            throw IntegrityError{"bad archive directory"};
+                        }
+                    }
+                } else {
+                    offset = readWide(fi);
+                }
+                m.size = readWide(fi);
+                m.crc = fi.readBits(WORD_SIZE);
+                m.mtime = static_cast<int64_t>(readWide(fi));
+                m.mode = fi.readBits(WORD_SIZE);
+                m.name.resize(fi.readBits(16));
+                size_t n = fi.readBytes(reinterpret_cast<unsigned char*>(m.name.data()), m.name.size());
+                if (n != m.name.size() || !safeName(m.name)) {
+                    throw IntegrityError{"bad archive directory"};
+                }
+                if (!dedup) {
+                    if (!inStream(offset, m.size)) {
+                        throw IntegrityError{"bad archive directory"};
+                    }
+                    if (m.size > 0) {
+                        m.extents.push_back(Extent{offset, m.size});
+                    }
+                }
+                uint64_t total = 0;
+                for (const Extent& e : m.extents) {
+                    total += e.size;
+                }
+                if (total != m.size) {
+                    throw IntegrityError{"bad archive directory"};
+                }
+            }
+        } catch (EOFReachedException& ex) {
+            throw IntegrityError{"bad archive directory"};
+        }
+    }
+
+    // algorithm and model settings the groups were coded with
+    const ArchiveHeader& Header() const {
+        return header;
+    }
+
+    const std::vector<Member>& Members() const {
+        return members;
+    }
+
+    const std::vector<Group>& Groups() const {
+        return groups;
+    }
+
+    // Index of the group holding byte `offset` of the solid stream.
+    size_t GroupOf(uint64_t offset) const {
+        return static_cast<size_t>(offset / group_size);
+    }
+
+    // Extracts members [first, last), decoding only the groups they cover.
+    // Every member is checked against its CRC before done() is called.
+    void Extract(size_t first, size_t last, const Codec& codec, unsigned threads,
+                 const OpenMember& open, const MemberDone& done) const {
+        // the groups in the order the extents need them; in a deduplicated
+        // archive a group may come up again for a later member
+        std::vector<size_t> sequence;
+        for (size_t i = first; i < last; ++i) {
+            for (const Extent& e : members[i].extents) {
+                for (size_t g = GroupOf(e.offset); g <= GroupOf(e.offset + e.size - 1); ++g) {
+                    if (sequence.empty() || sequence.back() != g) {
+                        sequence.push_back(g);
+                    }
+                }
+            }
+        }
+
+        size_t m = first;
+        size_t e = 0; // extent of members[m]
+        uint64_t done_bytes = 0; // of that extent
+        std::unique_ptr<ByteSink> out;
+        CRC32C crc;
+
+        // completes the members with nothing left to write, empty ones included
+        auto finishWritten = [&]() {
+            while (m < last && e == members[m].extents.size()) {
+                if (!out) {
+                    out = open(members[m]);
+                }
+                out->close();
+                if (!out->good()) {
+                    throw std::runtime_error("SolidArchive: can't write " + members[m].name);
+                }
+                out.reset();
+                if (crc.value() != members[m].crc) {
+                    throw IntegrityError{members[m].name + ": CRC mismatch"};
+                }
+                done(members[m]);
+                crc.reset();
+                ++m;
+                e = 0;
+            }
+        };
+
+        forEachGroup(sequence, codec, threads, [&](size_t g, const Block& raw) {
+            uint64_t gstart = uint64_t(g) * group_size;
+            uint64_t gend = gstart + raw.size();
+            while (true) {
+                finishWritten();
+                if (m == last) {
+                    break;
+                }
+                const Member& mem = members[m];
+                const Extent& ext = mem.extents[e];
+                uint64_t from = ext.offset + done_bytes;
+                if (from < gstart || from >= gend) {
+                    break;
+                }
+                if (!out) {
+                    out = open(mem);
+                }
+                uint64_t to = std::min(ext.offset + ext.size, gend);
+                out->write(raw.data() + (from - gstart), to - from);
+                if (!out->good()) {
+                    throw std::runtime_error("SolidArchive: can't write " + mem.name);
+                }
+                crc.update(raw.data() + (from - gstart), to - from);
+                done_bytes += to - from;
+                if (done_bytes == ext.size) {
+                    ++e;
+                    done_bytes = 0;
+                }
+            }
+        });
+        finishWritten();
+        if (m != last) {
+            throw IntegrityError{"truncated archive"};
+        }
+    }
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "bitstream.hpp"
+#include "frequency_model.hpp"
+
+#include "algorithm"
+#include "cstdint"
+#include "stdexcept"
+#include "vector"
+
+
+// Counts byte values with four interleaved tables, so runs of the same
+// byte update different counters instead of stalling on one
+// store-to-load chain; the tables are summed at the end. Counts are 64-bit
+// so inputs of 4 GiB and more don't wrap them.
+inline void Histogram(const unsigned char* data, size_t size, uint64_t hist[256]) {
+    uint64_t counts[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        ++counts[0][data[i]];
+        ++counts[1][data[i + 1]];
+        ++counts[2][data[i + 2]];
+        ++counts[3][data[i + 3]];
+    }
+    for (; i < size; ++i) {
+        ++counts[0][data[i]];
+    }
+    for (int c = 0; c < 256; ++c) {
+        hist[c] += counts[0][c] + counts[1][c] + counts[2][c] + counts[3][c];
+    }
+}
+
+// Scales `hist` to byte frequencies that add up to `target`, keeping every
+// byte that occurs at least 1. Returns false (all zeros) for an empty
+// histogram.
+inline bool QuantizeFrequencies(const uint64_t hist[256], uint32_t target, uint32_t freq[256]) {
+    uint64_t size = 0;
+    for (int c = 0; c < 256; ++c) {
+        size += hist[c];
+    }
+    std::fill(freq, freq + 256, 0);
+    if (size == 0) {
+        return false;
+    }
+
+    uint32_t sum = 0;
+    for (int c = 0; c < 256; ++c) {
+        if (hist[c] != 0) {
+            // hist * target / size, approximated where the product overflows
+            uint64_t scaled = hist[c] <= uint64_t(-1) / target ? hist[c] * target / size
+                                                                : hist[c] / (size / target);
+            freq[c] = std::max<uint32_t>(1, static_cast<uint32_t>(scaled));
+        }
+        sum += freq[c];
+    }
+    // rounding leftovers go to (or come from) the most frequent bytes
+    while (sum != target) {
+        int top = static_cast<int>(std::max_element(freq, freq + 256) - freq);
+        if (sum < target) {
+            freq[top] += target - sum;
+            sum = target;
+        } else {
+            uint32_t cut = std::min(sum - target, freq[top] - 1);
+            freq[top] -= cut;
+            sum -= cut;
+        }
+    }
+    return true;
+}
+
+// Frequency table layout: a 256-bit presence map, then freq - 1 of every
+// present byte in `bits` bits, padded to a whole byte.
+inline void WriteFrequencies(BitStream& fo, const uint32_t freq[256], int bits) {
+    for (int c = 0; c < 256; ++c) {
+        fo.writeBits(freq[c] != 0, 1);
+    }
+    for (int c = 0; c < 256; ++c) {
+        if (freq[c] != 0) {
+            fo.writeBits(freq[c] - 1, bits);
+        }
+    }
+    fo.alignToByte();
+}
+
+// Reads a table written by WriteFrequencies; returns the sum of freq.
+inline uint32_t ReadFrequencies(BitStream& fi, uint32_t freq[256], int bits) {
+    bool present[256];
+    for (int c = 0; c < 256; ++c) {
+        present[c] = fi.readBits(1);
+    }
+    uint32_t sum = 0;
+    for (int c = 0; c < 256; ++c) {
+        freq[c] = present[c] ? fi.readBits(bits) + 1 : 0;
+        sum += freq[c];
+    }
+    fi.alignToByte();
+    return sum;
+}
+
+// Fixed order-0 model for two-pass coding. The encoder histograms the whole
+// input, quantizes it to TOTAL and stores the table ahead of the payload;
+// nothing is updated while coding. Symbols are found through a direct
+// TOTAL-entry lookup table rather than a search.
+class StaticModel {
+public:
+    static constexpr int SCALE_BITS = 14;
+    static constexpr uint32_t TOTAL = uint32_t(1) << SCALE_BITS;
+
+private:
+    static constexpr int SYMBOLS = 257;
+    static constexpr int EOF_CODE = 256;
+    static constexpr size_t CHUNK_SIZE = 65536;
+
+    uint32_t freq[SYMBOLS];
+    uint32_t cum[SYMBOLS + 1];
+    uint16_t symbol_of[TOTAL];
+
+    void build() {
+        cum[0] = 0;
+        for (int c = 0; c < SYMBOLS; ++c) {
+            cum[c + 1] = cum[c] + freq[c];
+            for (uint32_t i = cum[c]; i < cum[c + 1]; ++i) {
+                symbol_of[i] = static_cast<uint16_t>(c);
+            }
+        }
+    }
+
+public:
+    // Scales `hist` so the byte frequencies add up to TOTAL - 1; EOF takes
+    // the remaining 1.
+    void quantize(const uint64_t hist[256]) {
+        freq[EOF_CODE] = QuantizeFrequencies(hist, TOTAL - 1, freq) ? 1 : TOTAL;
+        build();
+    }
+
+    void write(BitStream& fo) const {
+        WriteFrequencies(fo, freq, SCALE_BITS);
+    }
+
+    void read(BitStream& fi) {
+        uint32_t sum = ReadFrequencies(fi, freq, SCALE_BITS);
+        if (sum != 0 && sum != TOTAL - 1) {
+            throw std::runtime_error("StaticModel: corrupted frequency table");
+        }
+        freq[EOF_CODE] = sum == 0 ? TOTAL : 1;
+        build();
+    }
+
+    Probability getProbability(int c) const {
+        return {cum[c], cum[c + 1], TOTAL};
+    }
+
+    Probability getChar(uint32_t scaled_value, int &c) const {
+        if (scaled_value >= TOTAL) {
+            throw std::logic_error("Error in getChar");
+        }
+        c = symbol_of[scaled_value];
+        return {cum[c], cum[c + 1], TOTAL};
+    }
+
+    uint32_t getCount() const {
+        return TOTAL;
+    }
+
+    // Builds the model from a first pass over fi, writes it to fo and calls
+    // encode(model, input) for the second pass. Inputs that can't be
+    // rewound (pipes, pipeline stages) are held in memory in between.
+    template <class F>
+    static void TwoPass(BitStream& fi, BitStream& fo, F encode) {
+        StaticModel model;
+        uint64_t hist[256] = {};
+        if (fi.rewindable()) {
+            std::vector<unsigned char> chunk(CHUNK_SIZE);
+            while (size_t n = fi.readBytes(chunk.data(), chunk.size())) {
+                Histogram(chunk.data(), n, hist);
+            }
+            fi.rewind();
+            model.quantize(hist);
+            model.write(fo);
+            encode(model, fi);
+            return;
+        }
+
+        std::vector<unsigned char> data;
+        size_t size = 0;
+        do {
+            data.resize(size + CHUNK_SIZE);
+            size += fi.readBytes(data.data() + size, CHUNK_SIZE);
+        } while (size == data.size());
+        Histogram(data.data(), size, hist);
+        model.quantize(hist);
+        model.write(fo);
+        BitStream in(std::make_unique<MemorySource>(data.data(), size));
+        encode(model, in);
+    }
+};
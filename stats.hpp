@@ -0,0 +1,339 @@
+#pragma once
+
+// Counters and phase timers for seeing where the time goes on real inputs.
+// Everything is behind ARCHIVER_STATS: without it the STATS_* macros expand
+// to nothing and the coders' hot loops are exactly what they were.
+//
+//   STATS_ADD(counter, n) / STATS_MAX(counter, v) / STATS_SET(counter, v)
+//   STATS_PHASE(phase)          times the rest of the scope
+//   STATS_FILE(label)           attributes this thread's work to a file
+//   STATS_CONTEXT(name)         captures the current file for another thread,
+//   STATS_CAPTURE(name)         lists it in that thread's lambda captures
+//   STATS_ADOPT(name)           and installs it there
+//
+// Every thread updates a record of its own, keyed by file and thread, so the
+// hot path takes no lock. Phases are exclusive: a READ inside CODE pauses
+// CODE, so the phase times of a thread add up to its busy time.
+
+#ifdef ARCHIVER_STATS
+
+#include "chrono"
+#include "cstdint"
+#include "deque"
+#include "iomanip"
+#include "memory"
+#include "mutex"
+#include "ostream"
+#include "sstream"
+#include "string"
+#include "thread"
+#include "vector"
+
+
+class Stats {
+public:
+    enum Counter {
+        BYTES_IN,           // read by BitStreams
+        BYTES_OUT,          // written by BitStreams
+        RAW_BYTES,          // size of the original file
+        LZW_RESETS,         // CLEAR codes
+        LZW_PEAK_ENTRIES,   // largest dictionary
+        BAC_FREEZES,        // legacy models that stopped adapting
+        BAC_FREEZE_AT,      // symbols coded when the last one froze
+        PENDING_BURSTS,     // BAC renormalizations that released pending bits
+        PENDING_BITS_MAX,   // longest such burst
+        COUNTER_COUNT
+    };
+
+    enum Phase {
+        READ,
+        CODE,
+        WRITE,
+        PHASE_COUNT
+    };
+
+    struct Event {
+        Phase phase;
+        uint64_t start_ns;
+        uint64_t duration_ns;
+    };
+
+    struct Record {
+        std::string file;
+        std::thread::id thread;
+        uint64_t counters[COUNTER_COUNT] = {};
+        uint64_t phase_ns[PHASE_COUNT] = {};
+        uint64_t phase_calls[PHASE_COUNT] = {};
+        std::vector<Event> events;
+    };
+
+    using Context = std::string;
+
+    class PhaseTimer;
+
+    // trace events kept per record, so a long run can't eat all memory
+    static constexpr size_t MAX_EVENTS = size_t(1) << 20;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Registry {
+        std::mutex mutex;
+        std::deque<Record> records; // stable addresses
+        Clock::time_point epoch = Clock::now();
+        bool tracing = false;
+    };
+
+    static Registry& registry() {
+        static Registry instance;
+        return instance;
+    }
+
+    struct ThreadState {
+        Record* record = nullptr;
+        PhaseTimer* active = nullptr;
+    };
+
+    static ThreadState& state() {
+        thread_local ThreadState instance;
+        return instance;
+    }
+
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - registry().epoch).count();
+    }
+
+    static Record* open(const std::string& file) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::thread::id id = std::this_thread::get_id();
+        for (Record& rec : r.records) {
+            if (rec.thread == id && rec.file == file) {
+                return &rec;
+            }
+        }
+        r.records.emplace_back();
+        r.records.back().file = file;
+        r.records.back().thread = id;
+        return &r.records.back();
+    }
+
+    static const char* counterName(int c) {
+        static const char* names[COUNTER_COUNT] = {
+            "bytes_in", "bytes_out", "raw_bytes", "lzw_resets", "lzw_peak_entries",
+            "bac_freezes", "bac_freeze_at", "pending_bursts", "pending_bits_max"
+        };
+        return names[c];
+    }
+
+    static const char* phaseName(int p) {
+        static const char* names[PHASE_COUNT] = {"read", "code", "write"};
+        return names[p];
+    }
+
+    static std::string quoted(const std::string& s) {
+        std::string res = "\"";
+        for (char ch : s) {
+            if (ch == '"' || ch == '\\') {
+                res += '\\';
+            }
+            res += ch;
+        }
+        return res + '"';
+    }
+
+    // small dense ids for the threads, in order of appearance
+    static std::vector<size_t> threadIds(const std::deque<Record>& records) {
+        std::vector<std::thread::id> seen;
+        std::vector<size_t> ids;
+        for (const Record& rec : records) {
+            size_t i = 0;
+            while (i < seen.size() && seen[i] != rec.thread) {
+                ++i;
+            }
+            if (i == seen.size()) {
+                seen.push_back(rec.thread);
+            }
+            ids.push_back(i);
+        }
+        return ids;
+    }
+
+public:
+    static Record& current() {
+        ThreadState& s = state();
+        if (s.record == nullptr) {
+            s.record = open("");
+        }
+        return *s.record;
+    }
+
+    // Also keeps a trace event per phase, for ExportTrace.
+    static void EnableTracing() {
+        registry().tracing = true;
+    }
+
+    static void add(Counter c, uint64_t n) {
+        current().counters[c] += n;
+    }
+
+    static void max(Counter c, uint64_t v) {
+        uint64_t& slot = current().counters[c];
+        if (v > slot) {
+            slot = v;
+        }
+    }
+
+    static void set(Counter c, uint64_t v) {
+        current().counters[c] = v;
+    }
+
+    // Attributes the thread's work to `file` until destroyed.
+    class Scope {
+    private:
+        Record* saved;
+
+    public:
+        explicit Scope(const std::string& file) : saved(state().record) {
+            state().record = open(file);
+        }
+
+        ~Scope() {
+            state().record = saved;
+        }
+    };
+
+    static Context context() {
+        return current().file;
+    }
+
+    class PhaseTimer {
+    private:
+        Phase phase;
+        PhaseTimer* parent;
+        uint64_t start;
+
+        void charge(uint64_t end) {
+            Record& rec = current();
+            rec.phase_ns[phase] += end - start;
+            if (registry().tracing && rec.events.size() < MAX_EVENTS && end > start) {
+                rec.events.push_back(Event{phase, start, end - start});
+            }
+        }
+
+    public:
+        explicit PhaseTimer(Phase phase) : phase(phase), parent(state().active), start(now()) {
+            if (parent) {
+                parent->charge(start);
+            }
+            state().active = this;
+            ++current().phase_calls[phase];
+        }
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+        ~PhaseTimer() {
+            uint64_t end = now();
+            charge(end);
+            state().active = parent;
+            if (parent) {
+                parent->start = end;
+            }
+        }
+    };
+
+    // One object per (file, thread) record.
+    static void ExportJson(std::ostream& out) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::vector<size_t> ids = threadIds(r.records);
+        out << "{\n  \"records\": [";
+        for (size_t i = 0; i < r.records.size(); ++i) {
+            const Record& rec = r.records[i];
+            out << (i ? ",\n" : "\n") << "    {\"file\": " << quoted(rec.file)
+                << ", \"thread\": " << ids[i];
+            for (int c = 0; c < COUNTER_COUNT; ++c) {
+                out << ", \"" << counterName(c) << "\": " << rec.counters[c];
+            }
+            for (int p = 0; p < PHASE_COUNT; ++p) {
+                out << ", \"" << phaseName(p) << "_sec\": " << std::fixed << std::setprecision(6)
+                    << rec.phase_ns[p] * 1e-9 << ", \"" << phaseName(p) << "_calls\": " << rec.phase_calls[p];
+            }
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    static void ExportCsv(std::ostream& out) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::vector<size_t> ids = threadIds(r.records);
+        out << "file,thread";
+        for (int c = 0; c < COUNTER_COUNT; ++c) {
+            out << ',' << counterName(c);
+        }
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            out << ',' << phaseName(p) << "_sec," << phaseName(p) << "_calls";
+        }
+        out << '\n';
+        for (size_t i = 0; i < r.records.size(); ++i) {
+            const Record& rec = r.records[i];
+            out << quoted(rec.file) << ',' << ids[i];
+            for (int c = 0; c < COUNTER_COUNT; ++c) {
+                out << ',' << rec.counters[c];
+            }
+            for (int p = 0; p < PHASE_COUNT; ++p) {
+                out << ',' << std::fixed << std::setprecision(6) << rec.phase_ns[p] * 1e-9
+                    << ',' << rec.phase_calls[p];
+            }
+            out << '\n';
+        }
+    }
+
+    // Chrome trace event format (chrome://tracing, Perfetto): one complete
+    // event per phase, on a track per thread.
+    static void ExportTrace(std::ostream& out) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::vector<size_t> ids = threadIds(r.records);
+        out << "{\"traceEvents\": [";
+        bool first = true;
+        for (size_t i = 0; i < r.records.size(); ++i) {
+            for (const Event& e : r.records[i].events) {
+                out << (first ? "\n" : ",\n") << "  {\"name\": \"" << phaseName(e.phase)
+                    << "\", \"cat\": " << quoted(r.records[i].file)
+                    << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << ids[i] << std::fixed << std::setprecision(3)
+                    << ", \"ts\": " << e.start_ns * 1e-3 << ", \"dur\": " << e.duration_ns * 1e-3 << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+    }
+};
+
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+
+#define STATS_ADD(counter, n) Stats::add(Stats::counter, (n))
+#define STATS_MAX(counter, v) Stats::max(Stats::counter, (v))
+#define STATS_SET(counter, v) Stats::set(Stats::counter, (v))
+#define STATS_PHASE(phase) Stats::PhaseTimer STATS_CONCAT(stats_phase_, __LINE__)(Stats::phase)
+#define STATS_FILE(label) Stats::Scope STATS_CONCAT(stats_scope_, __LINE__)(label)
+#define STATS_CONTEXT(name) Stats::Context name = Stats::context()
+#define STATS_CAPTURE(name) , name
+#define STATS_ADOPT(name) Stats::Scope STATS_CONCAT(stats_scope_, __LINE__)(name)
+
+#else
+
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_MAX(counter, v) ((void)0)
+#define STATS_SET(counter, v) ((void)0)
+#define STATS_PHASE(phase) ((void)0)
+#define STATS_FILE(label) ((void)0)
+#define STATS_CONTEXT(name) ((void)0)
+#define STATS_CAPTURE(name)
+#define STATS_ADOPT(name) ((void)0)
+
+#endif
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "stats.hpp"
+
+#include "atomic"
+#include "condition_variable"
+#include "deque"
+#include "functional"
+#include "future"
+#include "memory"
+#include "mutex"
+#include "queue"
+#include "thread"
+#include "vector"
+
+
+// Fixed set of worker threads draining a shared FIFO of tasks.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Finishes the queued tasks before joining.
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    unsigned size() const {
+        return workers.size();
+    }
+
+    // Exceptions thrown by f are rethrown from the future's get().
+    template <class F>
+    auto submit(F f) -> std::future<decltype(f())> {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        std::future<decltype(f())> res = task->get_future();
+        // the task counts towards the file of whoever submitted it
+        STATS_CONTEXT(stats_context);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([task STATS_CAPTURE(stats_context)] {
+                STATS_ADOPT(stats_context);
+                (*task)();
+            });
+        }
+        ready.notify_one();
+        return res;
+    }
+};
+
+
+// Pool where every worker owns a deque of tasks. Submitted tasks are dealt
+// round-robin; a worker takes its own tasks from the front, in submission
+// order, and when it runs dry steals from the back of the others. Submitting
+// the largest jobs first therefore keeps the big ones on their owners and
+// lets idle workers mop up the small tail.
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> pending{0};
+    size_t next_queue = 0;
+
+    std::mutex idle_mutex;
+    std::condition_variable idle;
+    bool stopping = false;
+
+    bool popOwn(size_t self, std::function<void()>& task) {
+        Queue& q = *queues[self];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) {
+            return false;
+        }
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(size_t self, std::function<void()>& task) {
+        for (size_t k = 1; k < queues.size(); ++k) {
+            Queue& q = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        while (true) {
+            std::function<void()> task;
+            if (popOwn(self, task) || steal(self, task)) {
+                --pending;
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            idle.wait(lock, [this] { return stopping || pending != 0; });
+            if (stopping && pending == 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    // 0 threads means one per hardware thread
+    explicit WorkStealingPool(unsigned threads = 0) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Finishes the queued tasks before joining.
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    unsigned size() const {
+        return workers.size();
+    }
+
+    // Exceptions thrown by f are rethrown from the future's get().
+    template <class F>
+    auto submit(F f) -> std::future<decltype(f())> {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        std::future<decltype(f())> res = task->get_future();
+        STATS_CONTEXT(stats_context);
+        {
+            // counted before a thief can take it and count it off, and
+            // published before an idle worker can see the count
+            std::lock_guard<std::mutex> idle_lock(idle_mutex);
+            ++pending;
+            Queue& q = *queues[next_queue++ % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back([task STATS_CAPTURE(stats_context)] {
+                STATS_ADOPT(stats_context);
+                (*task)();
+            });
+        }
+        idle.notify_all();
+        return res;
+    }
+};